@@ -262,6 +262,9 @@ int main(int argc, char *argv[]) {
             run = false;
             continue;
         }
+        if(Kit_GetPlayerSeekError(player) != 0) {
+            fprintf(stderr, "%s\n", Kit_GetError());
+        }
 
         // Check for events
         const Uint8 *state;
@@ -12,6 +12,9 @@
 #include "kitchensink/kitconfig.h"
 #include "kitchensink/kitsource.h"
 #include "kitchensink/internal/utils/kitbuffer.h"
+#include "kitchensink/internal/utils/kitsignal.h"
+#include "kitchensink/internal/utils/kitpacketpool.h"
+#include "kitchensink/internal/utils/kitmemory.h"
 
 enum {
     KIT_DEC_BUF_IN = 0,
@@ -22,30 +25,47 @@ enum {
 typedef struct Kit_Decoder Kit_Decoder;
 
 typedef int (*dec_decode_cb)(Kit_Decoder *dec, AVPacket *in_packet);
+typedef void (*dec_flush_cb)(Kit_Decoder *dec);
+typedef void (*dec_suspend_cb)(Kit_Decoder *dec);
+typedef int (*dec_resume_cb)(Kit_Decoder *dec);
 typedef void (*dec_close_cb)(Kit_Decoder *dec);
 typedef void (*dec_free_packet_cb)(void *packet);
 
 struct Kit_Decoder {
     int stream_index;            ///< Source stream index for the current stream
+    int thread_count;            ///< Requested codec thread count
+    int lowres;                  ///< Requested resolution reduction, as a power of two (video only)
+    bool suspended;              ///< Codec is closed and buffers are freed (see Kit_SuspendDecoder())
     double clock_sync;           ///< Sync source for current stream
     double clock_pos;            ///< Current pts for the stream
+    double decoded_pts;          ///< End pts of the newest decoded output (set by decoder)
     AVRational aspect_ratio;     ///< Aspect ratio for the current frame (may change frome-to-frame)
     Kit_OutputFormat output;     ///< Output format for the decoder
 
     AVCodecContext *codec_ctx;   ///< FFMpeg internal: Codec context
     AVFormatContext *format_ctx; ///< FFMpeg internal: Format context (owner: Kit_Source)
 
-    SDL_mutex *output_lock;      ///< Threading lock for output buffer
-    Kit_Buffer *buffer[2];       ///< Buffers for incoming and decoded packets
+    Kit_Buffer *buffer[2];       ///< SPSC queues for incoming and decoded packets (lock-free on the producer side)
+    SDL_mutex *output_lock;      ///< Held by the output reader from peek to advance, and while clearing output
+    Kit_PacketPool *packet_pool; ///< Consumed input packets are returned here (owner: Kit_Player)
+    Kit_MemoryCounter *memory;   ///< Memory usage counter for buffered data (owner: Kit_Player)
+    Kit_Signal *decode_signal;   ///< Raised when there is new input or free output space (owner: Kit_Player)
+    Kit_Signal *demux_signal;    ///< Raised when input buffer space is freed (owner: Kit_Player)
+    const Kit_Decoder *yield_to; ///< Decoder that goes first when it is running low (owner: Kit_Player)
+    double yield_started;        ///< System time when we started waiting on yield_to (0 if not waiting)
+    Kit_Signal *yield_signal;    ///< Raised after decoding, to resume decoders yielding to us (owner: Kit_Player)
 
     void *userdata;              ///< Decoder specific information (Audio, video, subtitle context)
     dec_decode_cb dec_decode;    ///< Decoder decoding function callback
+    dec_flush_cb dec_flush;      ///< Decoder buffer flush callback (optional)
+    dec_suspend_cb dec_suspend;  ///< Frees decoder specific resources on suspend (optional)
+    dec_resume_cb dec_resume;    ///< Reallocates resources freed on suspend (optional)
     dec_close_cb dec_close;      ///< Decoder close function callback
 };
 
 KIT_LOCAL Kit_Decoder* Kit_CreateDecoder(const Kit_Source *src, int stream_index,
                                          int out_b_size, dec_free_packet_cb free_out_cb,
-                                         int thread_count);
+                                         int thread_count, int lowres, Kit_MemoryCounter *memory);
 KIT_LOCAL void Kit_CloseDecoder(Kit_Decoder *dec);
 
 KIT_LOCAL int Kit_GetDecoderStreamIndex(const Kit_Decoder *dec);
@@ -55,26 +75,37 @@ KIT_LOCAL int Kit_GetDecoderOutputFormat(const Kit_Decoder *dec, Kit_OutputForma
 KIT_LOCAL void Kit_SetDecoderClockSync(Kit_Decoder *dec, double sync);
 KIT_LOCAL void Kit_ChangeDecoderClockSync(Kit_Decoder *dec, double sync);
 
+KIT_LOCAL double Kit_GetDecoderHeadroom(const Kit_Decoder *dec);
+KIT_LOCAL bool Kit_IsDecoderStarving(const Kit_Decoder *dec);
+KIT_LOCAL bool Kit_ShouldDecoderYield(Kit_Decoder *dec);
+
 KIT_LOCAL int Kit_RunDecoder(Kit_Decoder *dec);
-KIT_LOCAL void Kit_ClearDecoderBuffers(const Kit_Decoder *dec);
+KIT_LOCAL void Kit_ClearDecoderBuffers(Kit_Decoder *dec);
+KIT_LOCAL int Kit_SuspendDecoder(Kit_Decoder *dec);
+KIT_LOCAL int Kit_ResumeDecoder(Kit_Decoder *dec);
 
+KIT_LOCAL void Kit_SetDecoderInputLimits(const Kit_Decoder *dec, unsigned int max_bytes, unsigned int max_ms);
 KIT_LOCAL bool Kit_CanWriteDecoderInput(const Kit_Decoder *dec);
+KIT_LOCAL unsigned int Kit_GetDecoderInputSize(const Kit_Decoder *dec);
 KIT_LOCAL int Kit_WriteDecoderInput(const Kit_Decoder *dec, AVPacket *packet);
 KIT_LOCAL AVPacket* Kit_ReadDecoderInput(const Kit_Decoder *dec);
 KIT_LOCAL void Kit_ClearDecoderInput(const Kit_Decoder *dec);
 KIT_LOCAL AVPacket* Kit_PeekDecoderInput(const Kit_Decoder *dec);
+KIT_LOCAL bool Kit_IsDecoderInputEmpty(const Kit_Decoder *dec);
 KIT_LOCAL void Kit_AdvanceDecoderInput(const Kit_Decoder *dec);
 
+KIT_LOCAL void Kit_SetDecoderOutputLimits(const Kit_Decoder *dec, unsigned int max_bytes, unsigned int max_ms);
 KIT_LOCAL int Kit_WriteDecoderOutput(const Kit_Decoder *dec, void *packet);
+KIT_LOCAL int Kit_WriteDecoderOutputItem(const Kit_Decoder *dec, void *packet, unsigned int bytes, double duration);
 KIT_LOCAL bool Kit_CanWriteDecoderOutput(const Kit_Decoder *dec);
+KIT_LOCAL bool Kit_IsDecoderOutputEmpty(const Kit_Decoder *dec);
 KIT_LOCAL void* Kit_PeekDecoderOutput(const Kit_Decoder *dec);
 KIT_LOCAL void* Kit_ReadDecoderOutput(const Kit_Decoder *dec);
 KIT_LOCAL void Kit_ClearDecoderOutput(const Kit_Decoder *dec);
+KIT_LOCAL int Kit_LockDecoderOutput(const Kit_Decoder *dec);
+KIT_LOCAL void Kit_UnlockDecoderOutput(const Kit_Decoder *dec);
 KIT_LOCAL void Kit_AdvanceDecoderOutput(const Kit_Decoder *dec);
 KIT_LOCAL void Kit_ForEachDecoderOutput(const Kit_Decoder *dec, Kit_ForEachItemCallback foreach_cb, void *userdata);
 KIT_LOCAL unsigned int Kit_GetDecoderOutputLength(const Kit_Decoder *dec);
 
-KIT_LOCAL int Kit_LockDecoderOutput(const Kit_Decoder *dec);
-KIT_LOCAL void Kit_UnlockDecoderOutput(const Kit_Decoder *dec);
-
 #endif // KITDECODER_H
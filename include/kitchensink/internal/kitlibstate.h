@@ -5,6 +5,9 @@
 #include "kitchensink/internal/libass.h"
 #endif // LIBASS
 #include "kitchensink/kitconfig.h"
+#include "kitchensink/internal/utils/kitworker.h"
+#include "kitchensink/internal/utils/kitparallel.h"
+#include "kitchensink/internal/utils/kitmemory.h"
 
 typedef struct Kit_LibraryState {
     unsigned int init_flags;
@@ -13,6 +16,31 @@ typedef struct Kit_LibraryState {
     unsigned int video_buf_frames;
     unsigned int audio_buf_frames;
     unsigned int subtitle_buf_frames;
+    unsigned int worker_threads;
+    unsigned int manual_pump;
+    unsigned int thread_priority;
+    unsigned int thread_affinity;
+    unsigned int video_buf_bytes;
+    unsigned int audio_buf_bytes;
+    unsigned int video_buf_ms;
+    unsigned int audio_buf_ms;
+    unsigned int video_direct_upload;
+    unsigned int video_in_bytes;
+    unsigned int audio_in_bytes;
+    unsigned int subtitle_in_bytes;
+    unsigned int video_in_ms;
+    unsigned int audio_in_ms;
+    unsigned int subtitle_in_ms;
+    unsigned int idle_suspend_ms;
+    unsigned int scale_quality;
+    unsigned int convert_threads;
+    unsigned int video_lowres;
+    unsigned int video_rgba_output;
+    Kit_WorkerPool *worker_pool;
+    SDL_SpinLock worker_pool_lock;
+    Kit_Parallel *convert_runner;
+    SDL_SpinLock convert_runner_lock;
+    Kit_MemoryCounter memory;
 #ifdef LIBASS
     ASS_Library *libass_handle;
     void *ass_so_handle;
@@ -20,5 +48,7 @@ typedef struct Kit_LibraryState {
 } Kit_LibraryState;
 
 KIT_LOCAL Kit_LibraryState* Kit_GetLibraryState();
+KIT_LOCAL Kit_WorkerPool* Kit_GetLibraryWorkerPool();
+KIT_LOCAL Kit_Parallel* Kit_GetLibraryConvertRunner();
 
 #endif // KITLIBSTATE_H
@@ -30,6 +30,7 @@ typedef struct Kit_TextureAtlas {
 
 KIT_LOCAL Kit_TextureAtlas* Kit_CreateAtlas();
 KIT_LOCAL void Kit_FreeAtlas(Kit_TextureAtlas *atlas);
+KIT_LOCAL size_t Kit_GetAtlasMemorySize(const Kit_TextureAtlas *atlas);
 KIT_LOCAL void Kit_ClearAtlasContent(Kit_TextureAtlas *atlas);
 KIT_LOCAL void Kit_CheckAtlasTextureSize(Kit_TextureAtlas *atlas, SDL_Texture *texture);
 KIT_LOCAL int Kit_GetAtlasItems(const Kit_TextureAtlas *atlas, SDL_Rect *sources, SDL_Rect *targets, int limit);
@@ -8,7 +8,8 @@
 #include "kitchensink/internal/kitdecoder.h"
 
 KIT_LOCAL Kit_Decoder* Kit_CreateSubtitleDecoder(
-    const Kit_Source *src, int stream_index, int video_w, int video_h, int screen_w, int screen_h);
+    const Kit_Source *src, int stream_index, int video_w, int video_h, int screen_w, int screen_h,
+    Kit_MemoryCounter *memory);
 KIT_LOCAL void Kit_GetSubtitleDecoderTexture(const Kit_Decoder *dec, SDL_Texture *texture, double sync_ts);
 KIT_LOCAL void Kit_SetSubtitleDecoderSize(const Kit_Decoder *dec, int w, int h);
 KIT_LOCAL int Kit_GetSubtitleDecoderInfo(
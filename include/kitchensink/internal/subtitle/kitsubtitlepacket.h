@@ -5,6 +5,7 @@
 #include <SDL_surface.h>
 
 #include "kitchensink/kitconfig.h"
+#include "kitchensink/internal/utils/kitmemory.h"
 
 typedef struct Kit_SubtitlePacket {
     double pts_start;
@@ -13,10 +14,12 @@ typedef struct Kit_SubtitlePacket {
     int y;
     bool clear;
     SDL_Surface *surface;
+    Kit_MemoryCounter *memory;
 } Kit_SubtitlePacket;
 
 KIT_LOCAL Kit_SubtitlePacket* Kit_CreateSubtitlePacket(
-    bool clear, double pts_start, double pts_end, int pos_x, int pos_y, SDL_Surface *surface);
+    bool clear, double pts_start, double pts_end, int pos_x, int pos_y, SDL_Surface *surface,
+    Kit_MemoryCounter *memory);
 KIT_LOCAL void Kit_FreeSubtitlePacket(Kit_SubtitlePacket *packet);
 
 #endif // KITSUBTITLEPACKET_H
@@ -1,23 +1,49 @@
 #ifndef KITBUFFER_H
 #define KITBUFFER_H
 
+#include <SDL_atomic.h>
+
 #include "kitchensink/kitconfig.h"
 
+#define KIT_CACHELINE_SIZE 64
+
 typedef struct Kit_Buffer Kit_Buffer;
 
 typedef void (*Kit_BufferFreeCallback)(void*);
 typedef void (*Kit_ForEachItemCallback)(void*, void *userdata);
 
+typedef struct Kit_BufferItemCost {
+    unsigned int bytes;     ///< Memory held by the item
+    unsigned int duration;  ///< Presentation time covered by the item, in microseconds
+} Kit_BufferItemCost;
+
+/*
+ * Single-producer, single-consumer ring buffer. Only one thread may write, and only one thread
+ * may read/peek/advance at a time. Writes and length checks are lock-free; consumer side
+ * operations take a spinlock for a few instructions, so that clearing from another thread is
+ * safe. Read and write positions are on separate cache lines, so that the producer and consumer
+ * do not keep stealing the same line from each other.
+ */
 struct Kit_Buffer {
-    unsigned int read_p;
-    unsigned int write_p;
-    unsigned int size;
+    SDL_atomic_t read_p;                                  ///< Consumer position (free-running)
+    char read_pad[KIT_CACHELINE_SIZE - sizeof(SDL_atomic_t)];
+    SDL_atomic_t write_p;                                 ///< Producer position (free-running)
+    char write_pad[KIT_CACHELINE_SIZE - sizeof(SDL_atomic_t)];
+    SDL_SpinLock read_lock;                               ///< Serializes consumer side operations
+    SDL_atomic_t bytes;                                   ///< Total bytes of queued items (saturates at INT_MAX)
+    SDL_atomic_t duration;                                ///< Total duration of queued items (microseconds, saturates at INT_MAX)
+    unsigned int size;                                    ///< Max. number of items in the buffer
+    unsigned int mask;                                    ///< Slot count - 1 (slot count is a power of two)
+    unsigned int max_bytes;                               ///< Buffer is full at this many bytes (0 = no limit)
+    unsigned int max_duration;                            ///< Buffer is full at this duration (microseconds, 0 = no limit)
     Kit_BufferFreeCallback free_cb;
+    Kit_BufferItemCost *costs;                            ///< Cost of the item in each slot
     void **data;
 };
 
 KIT_LOCAL Kit_Buffer* Kit_CreateBuffer(unsigned int size, Kit_BufferFreeCallback free_cb);
 KIT_LOCAL void Kit_DestroyBuffer(Kit_Buffer *buffer);
+KIT_LOCAL void Kit_SetBufferLimits(Kit_Buffer *buffer, unsigned int max_bytes, unsigned int max_duration);
 
 KIT_LOCAL unsigned int Kit_GetBufferLength(const Kit_Buffer *buffer);
 KIT_LOCAL void Kit_ClearBuffer(Kit_Buffer *buffer);
@@ -25,6 +51,7 @@ KIT_LOCAL void* Kit_ReadBuffer(Kit_Buffer *buffer);
 KIT_LOCAL void* Kit_PeekBuffer(const Kit_Buffer *buffer);
 KIT_LOCAL void Kit_AdvanceBuffer(Kit_Buffer *buffer);
 KIT_LOCAL int Kit_WriteBuffer(Kit_Buffer *buffer, void *ptr);
+KIT_LOCAL int Kit_WriteBufferItem(Kit_Buffer *buffer, void *ptr, unsigned int bytes, unsigned int duration);
 KIT_LOCAL void Kit_ForEachItemInBuffer(const Kit_Buffer *buffer, Kit_ForEachItemCallback cb, void *userdata);
 KIT_LOCAL int Kit_IsBufferFull(const Kit_Buffer *buffer);
 
@@ -0,0 +1,23 @@
+#ifndef KITMEMORY_H
+#define KITMEMORY_H
+
+#include <stddef.h>
+#include <SDL_atomic.h>
+
+#include "kitchensink/kitconfig.h"
+#include "kitchensink/kitlib.h"
+
+/*
+ * Memory usage counter. Allocation paths report what they allocate and free; every change is
+ * also applied to the library-wide counter.
+ */
+typedef struct Kit_MemoryCounter {
+    SDL_SpinLock lock;      ///< Protects the stats
+    Kit_MemoryStats stats;  ///< Current and peak usage
+} Kit_MemoryCounter;
+
+KIT_LOCAL void Kit_AddMemory(Kit_MemoryCounter *counter, int category, size_t bytes);
+KIT_LOCAL void Kit_RemoveMemory(Kit_MemoryCounter *counter, int category, size_t bytes);
+KIT_LOCAL void Kit_GetMemoryCounterStats(Kit_MemoryCounter *counter, Kit_MemoryStats *stats);
+
+#endif // KITMEMORY_H
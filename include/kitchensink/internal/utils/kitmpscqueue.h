@@ -0,0 +1,30 @@
+#ifndef KITMPSCQUEUE_H
+#define KITMPSCQUEUE_H
+
+#include <stddef.h>
+#include <SDL_atomic.h>
+
+#include "kitchensink/kitconfig.h"
+#include "kitchensink/internal/utils/kitbuffer.h"
+
+/*
+ * Bounded multi-producer, single-consumer queue for fixed size items. Any thread may push,
+ * but only one thread may pop at a time. Neither side takes locks.
+ */
+typedef struct Kit_MPSCQueue {
+    SDL_atomic_t write_p;       ///< Next position to claim for writing (shared by producers)
+    char write_pad[KIT_CACHELINE_SIZE - sizeof(SDL_atomic_t)];
+    unsigned int read_p;        ///< Next position to read (consumer only)
+    char read_pad[KIT_CACHELINE_SIZE - sizeof(unsigned int)];
+    unsigned int mask;          ///< Slot count - 1 (slot count is a power of two)
+    size_t item_size;           ///< Size of a single item in bytes
+    SDL_atomic_t *seq;          ///< Per-slot sequence numbers, tell whether a slot is free or filled
+    unsigned char *data;        ///< Item storage
+} Kit_MPSCQueue;
+
+KIT_LOCAL Kit_MPSCQueue* Kit_CreateMPSCQueue(unsigned int size, size_t item_size);
+KIT_LOCAL void Kit_DestroyMPSCQueue(Kit_MPSCQueue *queue);
+KIT_LOCAL int Kit_PushMPSCQueue(Kit_MPSCQueue *queue, const void *item);
+KIT_LOCAL int Kit_PopMPSCQueue(Kit_MPSCQueue *queue, void *item);
+
+#endif // KITMPSCQUEUE_H
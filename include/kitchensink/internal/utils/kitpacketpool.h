@@ -0,0 +1,25 @@
+#ifndef KITPACKETPOOL_H
+#define KITPACKETPOOL_H
+
+#include <SDL_atomic.h>
+#include <libavcodec/avcodec.h>
+
+#include "kitchensink/kitconfig.h"
+#include "kitchensink/internal/utils/kitmpscqueue.h"
+
+/*
+ * Recycles AVPacket structures, so that the demuxer does not need to allocate one for every
+ * packet it reads. Any thread may release packets, but only one thread may acquire at a time.
+ */
+typedef struct Kit_PacketPool {
+    Kit_MPSCQueue *free_packets; ///< Unreferenced packets waiting for reuse
+    SDL_atomic_t allocations;    ///< Number of packets allocated by the pool
+} Kit_PacketPool;
+
+KIT_LOCAL Kit_PacketPool* Kit_CreatePacketPool(unsigned int size);
+KIT_LOCAL void Kit_DestroyPacketPool(Kit_PacketPool *pool);
+KIT_LOCAL AVPacket* Kit_AcquirePacket(Kit_PacketPool *pool);
+KIT_LOCAL void Kit_ReleasePacket(Kit_PacketPool *pool, AVPacket *packet);
+KIT_LOCAL unsigned int Kit_GetPacketPoolAllocations(const Kit_PacketPool *pool);
+
+#endif // KITPACKETPOOL_H
@@ -0,0 +1,34 @@
+#ifndef KITPARALLEL_H
+#define KITPARALLEL_H
+
+#include <SDL_atomic.h>
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+
+#include "kitchensink/kitconfig.h"
+
+typedef void (*Kit_ParallelJob)(void *userdata, int index);
+
+/*
+ * Runs a batch of independent jobs on a set of helper threads, and waits for them all to finish.
+ * The calling thread takes jobs too. Any number of threads may share a runner; while the helpers
+ * are busy with one batch, other callers run their whole batch by themselves.
+ */
+typedef struct Kit_Parallel {
+    SDL_Thread **threads;   ///< Helper threads
+    int thread_count;       ///< Number of helper threads
+    SDL_sem *start;         ///< Posted once for each helper when a batch starts
+    SDL_sem *done;          ///< Posted by each helper when it runs out of jobs
+    SDL_atomic_t next;      ///< Next job index to take
+    SDL_atomic_t quitting;  ///< Set when helpers should exit
+    SDL_SpinLock busy;      ///< Held by the thread whose batch the helpers are working on
+    Kit_ParallelJob job;    ///< Job function for the current batch
+    void *userdata;         ///< Argument for the job function
+    int job_count;          ///< Number of jobs in the current batch
+} Kit_Parallel;
+
+KIT_LOCAL Kit_Parallel* Kit_CreateParallel(int thread_count);
+KIT_LOCAL void Kit_CloseParallel(Kit_Parallel *parallel);
+KIT_LOCAL void Kit_RunParallel(Kit_Parallel *parallel, Kit_ParallelJob job, void *userdata, int job_count);
+
+#endif // KITPARALLEL_H
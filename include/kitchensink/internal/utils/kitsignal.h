@@ -0,0 +1,27 @@
+#ifndef KITSIGNAL_H
+#define KITSIGNAL_H
+
+#include <stdbool.h>
+#include <SDL_mutex.h>
+
+#include "kitchensink/kitconfig.h"
+
+typedef void (*Kit_SignalCallback)(void *userdata);
+
+typedef struct Kit_Signal {
+    SDL_mutex *lock;
+    SDL_cond *cond;
+    bool raised;
+    Kit_SignalCallback callback; ///< Called every time the signal is raised (optional)
+    void *userdata;              ///< Argument for the callback
+} Kit_Signal;
+
+KIT_LOCAL Kit_Signal* Kit_CreateSignal();
+KIT_LOCAL void Kit_DestroySignal(Kit_Signal *signal);
+KIT_LOCAL void Kit_SetSignalCallback(Kit_Signal *signal, Kit_SignalCallback callback, void *userdata);
+KIT_LOCAL void Kit_RaiseSignal(Kit_Signal *signal);
+KIT_LOCAL void Kit_WaitSignal(Kit_Signal *signal);
+KIT_LOCAL bool Kit_WaitSignalTimeout(Kit_Signal *signal, Uint32 timeout_ms);
+KIT_LOCAL bool Kit_PollSignal(Kit_Signal *signal);
+
+#endif // KITSIGNAL_H
@@ -0,0 +1,10 @@
+#ifndef KITTHREAD_H
+#define KITTHREAD_H
+
+#include "kitchensink/kitconfig.h"
+
+KIT_LOCAL void Kit_SetupWorkerThread();
+KIT_LOCAL void* Kit_PushThreadAffinity();
+KIT_LOCAL void Kit_PopThreadAffinity(void *saved);
+
+#endif // KITTHREAD_H
@@ -0,0 +1,77 @@
+#ifndef KITWORKER_H
+#define KITWORKER_H
+
+#include <SDL_atomic.h>
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+
+#include "kitchensink/kitconfig.h"
+#include "kitchensink/internal/utils/kitsignal.h"
+
+typedef int (*Kit_WorkerStep)(void *userdata);
+
+#define KIT_WORKER_WAIT_MS 10  // Longest sleep of a dedicated worker thread after a step returns KIT_WORKER_WAIT
+
+typedef struct Kit_Worker Kit_Worker;
+typedef struct Kit_WorkerPool Kit_WorkerPool;
+
+enum {
+    KIT_WORKER_DONE = 0,  ///< Step result: idle until signaled
+    KIT_WORKER_AGAIN,     ///< Step result: run again right away
+    KIT_WORKER_WAIT       ///< Step result: waiting on something that may not signal; run again soon
+};
+
+enum {
+    KIT_WORKER_IDLE = 0,  ///< Not queued or running
+    KIT_WORKER_QUEUED,    ///< Waiting in a pool queue
+    KIT_WORKER_RUNNING,   ///< Being run by a pool thread
+    KIT_WORKER_RERUN      ///< Being run by a pool thread, and was signaled again meanwhile
+};
+
+struct Kit_Worker {
+    Kit_WorkerStep step;      ///< Does some work. Returns KIT_WORKER_DONE, KIT_WORKER_AGAIN or KIT_WORKER_WAIT.
+    void *userdata;           ///< Argument for the step function
+    SDL_mutex *lock;          ///< Held while the step function runs
+    Kit_Signal *signal;       ///< Raised when there may be new work for the worker
+    SDL_Thread *thread;       ///< Dedicated thread running the worker (NULL if pooled or manual)
+    Kit_WorkerPool *pool;     ///< Pool running the worker (NULL if dedicated or manual)
+    SDL_atomic_t state;       ///< Pool scheduling state (KIT_WORKER_IDLE, ...)
+    SDL_atomic_t closing;     ///< Set when the worker should exit
+    SDL_atomic_t max_hold_us; ///< Longest time a single step has held the lock (microseconds)
+    Kit_Worker *next;         ///< Next worker in the pool queue
+};
+
+typedef struct Kit_WorkerQueue {
+    SDL_mutex *lock;       ///< Protects the queue contents
+    Kit_Worker *head;      ///< First queued worker
+    Kit_Worker *tail;      ///< Last queued worker
+    Kit_WorkerPool *pool;  ///< Pool that owns the queue
+    int index;             ///< Index of the queue (and its thread) in the pool
+} Kit_WorkerQueue;
+
+struct Kit_WorkerPool {
+    int thread_count;         ///< Number of threads (and queues) in the pool
+    SDL_Thread **threads;     ///< Pool threads
+    Kit_WorkerQueue *queues;  ///< Per-thread queues. Idle threads steal work from others.
+    SDL_sem *pending;         ///< Counts the total number of queued workers
+    SDL_atomic_t next_queue;  ///< Round-robin queue selector for submits from outside the pool
+    SDL_atomic_t quitting;    ///< Set when the pool threads should exit
+    SDL_TLSID queue_id;       ///< Thread local queue of the current pool thread
+    SDL_mutex *idle_lock;     ///< Held while pool threads set workers idle
+    SDL_cond *idle_cond;      ///< Signaled when a closing worker goes idle
+    SDL_atomic_t users;       ///< Number of open workers using the pool
+};
+
+KIT_LOCAL Kit_Worker* Kit_CreateWorker(Kit_WorkerPool *pool, const char *name, Kit_WorkerStep step, void *userdata);
+KIT_LOCAL Kit_Worker* Kit_CreateManualWorker(Kit_WorkerStep step, void *userdata);
+KIT_LOCAL int Kit_RunWorker(Kit_Worker *worker);
+KIT_LOCAL void Kit_CloseWorker(Kit_Worker *worker);
+KIT_LOCAL void Kit_WakeWorker(Kit_Worker *worker);
+KIT_LOCAL int Kit_LockWorker(Kit_Worker *worker);
+KIT_LOCAL void Kit_UnlockWorker(Kit_Worker *worker);
+KIT_LOCAL int Kit_GetWorkerMaxHoldTime(Kit_Worker *worker);
+
+KIT_LOCAL Kit_WorkerPool* Kit_CreateWorkerPool(int thread_count);
+KIT_LOCAL void Kit_CloseWorkerPool(Kit_WorkerPool *pool);
+
+#endif // KITWORKER_H
@@ -5,10 +5,15 @@
 
 #include "kitchensink/kitconfig.h"
 #include "kitchensink/kitsource.h"
+#include "kitchensink/kitplayer.h"
 #include "kitchensink/internal/kitdecoder.h"
 
-KIT_LOCAL Kit_Decoder* Kit_CreateVideoDecoder(const Kit_Source *src, int stream_index);
+KIT_LOCAL Kit_Decoder* Kit_CreateVideoDecoder(const Kit_Source *src, int stream_index, Kit_MemoryCounter *memory);
 KIT_LOCAL int Kit_GetVideoDecoderData(Kit_Decoder *dec, SDL_Texture *texture, SDL_Rect *area);
+KIT_LOCAL int Kit_AcquireVideoDecoderFrame(Kit_Decoder *dec, Kit_VideoFrame *frame);
+KIT_LOCAL void Kit_ReleaseVideoDecoderFrame(Kit_VideoFrame *frame);
 KIT_LOCAL double Kit_GetVideoDecoderPTS(const Kit_Decoder *dec);
+KIT_LOCAL void Kit_SetVideoDecoderSize(Kit_Decoder *dec, int w, int h);
+KIT_LOCAL double Kit_GetVideoDecoderConvertTime(const Kit_Decoder *dec);
 
 #endif // KITVIDEO_H
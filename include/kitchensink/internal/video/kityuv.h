@@ -0,0 +1,43 @@
+#ifndef KITYUV_H
+#define KITYUV_H
+
+#include <stdbool.h>
+#include <libavutil/frame.h>
+
+#include "kitchensink/kitconfig.h"
+
+// Fixed point conversion coefficients (Q12), plus offsets for the source range.
+typedef struct Kit_YUVCoeffs {
+    short y_offset;
+    short y_mul;
+    short v_to_r;
+    short u_to_g;
+    short v_to_g;
+    short u_to_b;
+    bool bgra;  ///< Store as B, G, R, A instead of R, G, B, A
+} Kit_YUVCoeffs;
+
+// Converts a single row of planar 4:2:0 data. Chroma rows have (width + 1) / 2 samples.
+typedef void (*Kit_YUVRowFunc)(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                               unsigned char *dst, int width, const Kit_YUVCoeffs *coeffs);
+
+/*
+ * Converts yuv420p, yuvj420p and nv12 frames to RGBA or BGRA without going through swscale.
+ * Row kernel is picked by CPU features (AVX2, SSE2, NEON or plain C). All kernels give exactly
+ * the same output as the plain C one.
+ *
+ * Chroma is upsampled by repeating samples (nearest neighbour), both horizontally and vertically.
+ * This matches the unscaled swscale YUV to RGB converters, which the decoder would otherwise use
+ * for the same conversion; the scale quality hint only affects scaled output.
+ */
+typedef struct Kit_YUVConverter {
+    Kit_YUVRowFunc row;     ///< Row kernel
+    Kit_YUVCoeffs coeffs;   ///< Coefficients for the frame colorspace and range
+    bool nv12;              ///< Chroma is interleaved in a single plane
+} Kit_YUVConverter;
+
+KIT_LOCAL Kit_YUVRowFunc Kit_GetYUVRowFunc(int index, const char **name);
+KIT_LOCAL bool Kit_InitYUVConverter(Kit_YUVConverter *conv, const AVFrame *src, enum AVPixelFormat out_fmt);
+KIT_LOCAL void Kit_RunYUVConverter(const Kit_YUVConverter *conv, const AVFrame *src, unsigned char *dst, int dst_pitch, int y, int h);
+
+#endif // KITYUV_H
@@ -9,6 +9,8 @@
  * @date 2018-06-25
  */
 
+#include <stddef.h>
+
 #include "kitchensink/kitconfig.h"
 
 #ifdef __cplusplus
@@ -26,6 +28,49 @@ enum {
     KIT_FONT_HINTING_COUNT
 };
 
+/**
+ * @brief Thread priority options. Used as values for Kit_SetHint(KIT_HINT_THREAD_PRIORITY, ...).
+ */
+enum {
+    KIT_THREAD_PRIORITY_DEFAULT = 0,  ///< Don't touch thread priority
+    KIT_THREAD_PRIORITY_LOW,  ///< Low priority, eg. to keep decoding from preempting rendering
+    KIT_THREAD_PRIORITY_NORMAL,  ///< Normal priority
+    KIT_THREAD_PRIORITY_HIGH,  ///< High priority
+    KIT_THREAD_PRIORITY_COUNT
+};
+
+/**
+ * @brief Video scaling filters. Used as values for Kit_SetHint(KIT_HINT_VIDEO_SCALE_QUALITY, ...).
+ */
+enum {
+    KIT_SCALE_BILINEAR = 0,  ///< Bilinear filtering. Good default
+    KIT_SCALE_FAST_BILINEAR,  ///< Faster, slightly lower quality bilinear filtering
+    KIT_SCALE_POINT,  ///< Nearest neighbour. Fastest, but blocky
+    KIT_SCALE_BICUBIC,  ///< Bicubic filtering. Sharper, but slower
+    KIT_SCALE_COUNT
+};
+
+/**
+ * @brief Memory usage categories. Used as indexes for Kit_MemoryStats arrays.
+ */
+enum {
+    KIT_MEMORY_PACKETS = 0,  ///< Demuxed packets waiting to be decoded
+    KIT_MEMORY_VIDEO,  ///< Decoded video frames, including pooled frame buffers not currently in use
+    KIT_MEMORY_AUDIO,  ///< Decoded audio sample buffers
+    KIT_MEMORY_SUBTITLES,  ///< Decoded subtitle surfaces and texture atlas data
+    KIT_MEMORY_COUNT
+};
+
+/**
+ * @brief Memory usage statistics, see Kit_GetLibraryMemoryStats() and Kit_GetPlayerMemoryStats()
+ */
+typedef struct Kit_MemoryStats {
+    size_t current[KIT_MEMORY_COUNT];  ///< Bytes currently allocated, per category
+    size_t peak[KIT_MEMORY_COUNT];  ///< Highest number of bytes allocated at once, per category
+    size_t total;  ///< Bytes currently allocated in all categories
+    size_t total_peak;  ///< Highest number of bytes allocated at once in all categories
+} Kit_MemoryStats;
+
 /**
  * @brief SDL_kitchensink library version container
  */
@@ -39,13 +84,38 @@ typedef struct Kit_Version {
  * @brief Library hint types. Used as keys for Kit_SetHint().
  * 
  * Note that all of these must be set *before* player initialization for them to take effect!
+ * 
+ * Buffer frame, byte and millisecond limits all apply together; a buffer is full when any of
+ * them is reached. A single frame is always let through, even if it exceeds the byte limit.
+ * Input limits work the same way for demuxed packets waiting to be decoded. Demuxing pauses
+ * whenever any of the decoders has a full input queue.
  */
 typedef enum Kit_HintType {
     KIT_HINT_FONT_HINTING, ///< Set font hinting mode (currently used for libass)
     KIT_HINT_THREAD_COUNT, ///< Set thread count for ffmpeg (1 by default). Set to 0 for autodetect.
     KIT_HINT_VIDEO_BUFFER_FRAMES, ///< Video output buffer frames (3 by default)
     KIT_HINT_AUDIO_BUFFER_FRAMES, ///< Audio output buffers (64 by default)
-    KIT_HINT_SUBTITLE_BUFFER_FRAMES ///< Subtitle output buffers (64 by default, used by image subtitles)
+    KIT_HINT_SUBTITLE_BUFFER_FRAMES, ///< Subtitle output buffers (64 by default, used by image subtitles)
+    KIT_HINT_WORKER_THREADS, ///< Threads in a decoder worker pool shared by all players (0 by default, max. CPU count). Set to 0 to give each player its own decoder threads. Demuxers always run on their own thread per player, since source reads may block.
+    KIT_HINT_MANUAL_PUMP, ///< If 1, players start no threads and must be driven by Kit_PlayerPump() (0 by default)
+    KIT_HINT_THREAD_PRIORITY, ///< Priority for demuxer and decoder threads (KIT_THREAD_PRIORITY_DEFAULT by default)
+    KIT_HINT_THREAD_AFFINITY, ///< CPU bitmask for demuxer, decoder and ffmpeg codec threads (0 = any CPU, default). Linux only.
+    KIT_HINT_VIDEO_BUFFER_BYTES, ///< Max. bytes of decoded video to buffer (0 = no limit, default)
+    KIT_HINT_AUDIO_BUFFER_BYTES, ///< Max. bytes of decoded audio to buffer (0 = no limit, default)
+    KIT_HINT_VIDEO_BUFFER_MS, ///< Max. milliseconds of decoded video to buffer (0 = no limit, default)
+    KIT_HINT_AUDIO_BUFFER_MS, ///< Max. milliseconds of decoded audio to buffer (0 = no limit, default)
+    KIT_HINT_VIDEO_DIRECT_UPLOAD, ///< If 1, convert video straight into locked streaming textures in Kit_GetPlayerVideoData() (0 by default)
+    KIT_HINT_VIDEO_INPUT_BYTES, ///< Max. bytes of video packets queued for decoding (16 MiB by default, 0 = no limit)
+    KIT_HINT_AUDIO_INPUT_BYTES, ///< Max. bytes of audio packets queued for decoding (1 MiB by default, 0 = no limit)
+    KIT_HINT_SUBTITLE_INPUT_BYTES, ///< Max. bytes of subtitle packets queued for decoding (1 MiB by default, 0 = no limit)
+    KIT_HINT_VIDEO_INPUT_MS, ///< Max. milliseconds of video packets queued for decoding (0 = no limit, default)
+    KIT_HINT_AUDIO_INPUT_MS, ///< Max. milliseconds of audio packets queued for decoding (0 = no limit, default)
+    KIT_HINT_SUBTITLE_INPUT_MS, ///< Max. milliseconds of subtitle packets queued for decoding (0 = no limit, default)
+    KIT_HINT_IDLE_SUSPEND_MS, ///< Suspend players that have been paused or stopped this long (0 = never, default). See Kit_PlayerSuspend().
+    KIT_HINT_VIDEO_SCALE_QUALITY, ///< Filter for video scaling, see Kit_SetPlayerOutputSize() (KIT_SCALE_BILINEAR by default)
+    KIT_HINT_VIDEO_CONVERT_THREADS, ///< Threads for converting video frames in horizontal slices, including the decoder thread (1 by default, max. CPU count). Helpers are shared by all players and created on first use; later changes apply after Kit_Quit().
+    KIT_HINT_VIDEO_LOWRES, ///< Decode video at 1/2^n of its size, for previews (0 = full size, default, max. 3). Output format reports the reduced size.
+    KIT_HINT_VIDEO_RGBA_OUTPUT ///< Output video as SDL_PIXELFORMAT_RGBA32 instead of the format closest to the source (0 = off, default). 4:2:0 sources are then converted without swscale.
 } Kit_HintType;
 
 /**
@@ -85,6 +155,9 @@ KIT_API int Kit_Init(unsigned int flags);
 /**
  * @brief Deinitializes SDL_kitchensink
  * 
+ * All players must be closed with Kit_ClosePlayer() before calling this, since they may be using
+ * the shared worker pool (see KIT_HINT_WORKER_THREADS) and conversion helpers (see KIT_HINT_VIDEO_CONVERT_THREADS).
+ * 
  * Note that any calls to library functions after this will cause undefined behaviour!
  */
 KIT_API void Kit_Quit();
@@ -108,6 +181,17 @@ KIT_API void Kit_SetHint(Kit_HintType type, int value);
  */
 KIT_API int Kit_GetHint(Kit_HintType type);
 
+/**
+ * @brief Fetches memory usage of all players combined
+ * 
+ * Only the large buffers are tracked (packets, frames, sample buffers and subtitle surfaces);
+ * codec internals and small bookkeeping structures are not included. Peak values are kept
+ * for the lifetime of the library.
+ * 
+ * @param stats Allocated Kit_MemoryStats
+ */
+KIT_API void Kit_GetLibraryMemoryStats(Kit_MemoryStats *stats);
+
 /**
  * @brief Can be used to fetch the version of the linked SDL_kitchensink library
  * 
@@ -11,9 +11,12 @@
 
 #include "kitchensink/kitsource.h"
 #include "kitchensink/kitconfig.h"
+#include "kitchensink/kitlib.h"
 #include "kitchensink/kitformat.h"
 #include "kitchensink/kitcodec.h"
 
+#include <stdbool.h>
+#include <SDL_atomic.h>
 #include <SDL_render.h>
 
 #ifdef __cplusplus
@@ -32,14 +35,27 @@ typedef enum Kit_PlayerState {
 
 /**
  * @brief Player state container
+ * 
+ * Note that `state` is an SDL_atomic_t (it used to be a Kit_PlayerState), since it is changed
+ * from control calls and the worker threads. This changes the struct layout and breaks ABI for
+ * code that reads it directly; use Kit_GetPlayerState() instead.
  */
 typedef struct Kit_Player {
-    Kit_PlayerState state;   ///< Playback state
+    SDL_atomic_t state;      ///< Playback state (Kit_PlayerState, read with Kit_GetPlayerState())
     void *decoders[3];       ///< Decoder contexts
-    void *dec_thread;        ///< Decoder thread
-    void *dec_lock;          ///< Decoder lock
+    void *demux_worker;      ///< Demuxer worker (reads packets from source)
+    void *decode_workers[3]; ///< Decoder workers (one for each decoder)
     const Kit_Source *src;   ///< Reference to Audio/Video source
-    double pause_started;    ///< Temporary flag for handling pauses
+    void *commands;          ///< Control command queue (consumed by demuxer worker)
+    void *packet_pool;       ///< Recycled packets shared by the demuxer and decoders
+    void *memory;            ///< Memory usage counter shared by all decoders
+    SDL_atomic_t pending_commands; ///< Number of control commands not yet handled
+    SDL_atomic_t seek_error; ///< Error code of the last failed asynchronous seek (0 if none), see Kit_GetPlayerSeekError()
+    double pause_started;    ///< Temporary flag for handling pauses (owner: demuxer worker)
+    double suspend_pos;      ///< Playback position when suspended (owner: demuxer worker)
+    SDL_atomic_t idle_since; ///< SDL_GetTicks() when playback last stopped or paused (0 if playing)
+    bool eof;                ///< Set when demuxer has reached the end of the source
+    bool suspended;          ///< Codecs are closed and buffers released (owner: demuxer worker)
 } Kit_Player;
 
 /**
@@ -60,6 +76,28 @@ typedef struct Kit_PlayerInfo {
     Kit_PlayerStreamInfo subtitle; ///< Subtitle stream data
 } Kit_PlayerInfo;
 
+/**
+ * @brief Contains runtime statistics about a player
+ */
+typedef struct Kit_PlayerStats {
+    double max_lock_hold; ///< Longest time a demuxer or decoder step has held its lock, in seconds
+    unsigned int packet_allocations; ///< Number of packets allocated so far. Stays constant once warmed up.
+    double convert_time; ///< Recent average time to convert a decoded video frame to the output format, in seconds (0 if none are converted)
+} Kit_PlayerStats;
+
+/**
+ * @brief Decoded video frame leased to the caller, see Kit_AcquirePlayerVideoFrame()
+ */
+typedef struct Kit_VideoFrame {
+    unsigned char *data[4]; ///< Plane pointers, in Y, U, V order for planar YUV. Unused planes are NULL.
+    int pitch[4];           ///< Plane strides in bytes
+    unsigned int format;    ///< SDL pixel format of the planes
+    int width;              ///< Frame width in pixels
+    int height;             ///< Frame height in pixels
+    double pts;             ///< Presentation timestamp in seconds
+    void *handle;           ///< Release handle, owned by the library
+} Kit_VideoFrame;
+
 /**
  * @brief Creates a new player from a source.
  * 
@@ -133,6 +171,25 @@ KIT_API void Kit_ClosePlayer(Kit_Player *player);
  */
 KIT_API void Kit_SetPlayerScreenSize(Kit_Player *player, int w, int h);
 
+/**
+ * @brief Sets the size video frames are scaled to
+ * 
+ * Frames are scaled while they are converted to the output format, so buffered frames and texture
+ * uploads only take as much memory and bandwidth as the given size needs. Eg. a 4K video shown in
+ * a small tile can be decoded straight to the tile size. Filter is selected with
+ * KIT_HINT_VIDEO_SCALE_QUALITY.
+ * 
+ * Frames that have already been decoded keep their old size. Kit_GetPlayerInfo() reports the new
+ * size right away, so textures can be reallocated to match. Set both to 0 to use the source size.
+ * 
+ * This does nothing if there is no video stream.
+ * 
+ * @param player Player instance
+ * @param w Output width in pixels, or 0
+ * @param h Output height in pixels, or 0
+ */
+KIT_API void Kit_SetPlayerOutputSize(Kit_Player *player, int w, int h);
+
 /**
  * @brief Gets the current video stream index
  * 
@@ -182,7 +239,10 @@ KIT_API int Kit_GetPlayerVideoData(Kit_Player *player, SDL_Texture *texture);
  * pick the texture format from what Kit_GetPlayerInfo() outputs.
  *
  * Access flag for the texture *MUST* always be SDL_TEXTUREACCESS_STATIC! Anything else will lead to
- * undefined behaviour.
+ * undefined behaviour. The exception is KIT_HINT_VIDEO_DIRECT_UPLOAD: with it set, a
+ * SDL_TEXTUREACCESS_STREAMING texture is locked and the frame is converted straight into its pixels,
+ * skipping the intermediate copy. In that mode the conversion runs in this function, not on the
+ * decoder thread.
  *
  * Area argument can be given to acquire the current video frame content area. Note that this may change
  * if you have video that changes frame size on the fly.
@@ -196,6 +256,34 @@ KIT_API int Kit_GetPlayerVideoData(Kit_Player *player, SDL_Texture *texture);
  */
 KIT_API int Kit_GetPlayerVideoDataArea(Kit_Player *player, SDL_Texture *texture, SDL_Rect *area);
 
+/**
+ * @brief Leases the current video frame from the player without copying it
+ *
+ * Picks the frame to show exactly like Kit_GetPlayerVideoDataArea() does, but instead of uploading
+ * it to a texture, hands out pointers to the decoded planes. Planes are in the output format that
+ * Kit_GetPlayerInfo() reports, and stay valid until the frame is given back with
+ * Kit_ReleasePlayerVideoFrame(). Every acquired frame must be released before the player is closed.
+ *
+ * Frames held by the caller are not counted against the video buffer limits, so hold on to them
+ * only as long as needed.
+ *
+ * This function will do nothing if player playback has not been started.
+ *
+ * @param player Player instance
+ * @param frame Frame to fill
+ * @return 1 if a frame was acquired, 0 otherwise
+ */
+KIT_API int Kit_AcquirePlayerVideoFrame(Kit_Player *player, Kit_VideoFrame *frame);
+
+/**
+ * @brief Gives a frame acquired with Kit_AcquirePlayerVideoFrame() back to the player
+ *
+ * Frame buffers are returned to the decoder for reuse. The frame contents are cleared.
+ *
+ * @param frame Acquired frame
+ */
+KIT_API void Kit_ReleasePlayerVideoFrame(Kit_VideoFrame *frame);
+
 /**
  * @brief Fetches subtitle data from the player
  * 
@@ -279,6 +367,29 @@ KIT_API void Kit_GetPlayerInfo(const Kit_Player *player, Kit_PlayerInfo *info);
  */
 KIT_API Kit_PlayerState Kit_GetPlayerState(const Kit_Player *player);
 
+/**
+ * @brief Fetches runtime statistics for the player
+ * 
+ * Control calls like Kit_PlayerSeek() may need to wait for a running demuxer or decoder step
+ * to finish, so max_lock_hold is roughly the worst case added latency for those.
+ * 
+ * @param player Player instance
+ * @param stats Allocated Kit_PlayerStats
+ */
+KIT_API void Kit_GetPlayerStats(const Kit_Player *player, Kit_PlayerStats *stats);
+
+/**
+ * @brief Fetches memory usage of the player
+ * 
+ * Reports the memory held by queued packets, decoded frames, audio sample buffers and
+ * subtitle data, with the highest values seen since the player was created. Library-wide
+ * totals are available via Kit_GetLibraryMemoryStats().
+ * 
+ * @param player Player instance
+ * @param stats Allocated Kit_MemoryStats
+ */
+KIT_API void Kit_GetPlayerMemoryStats(const Kit_Player *player, Kit_MemoryStats *stats);
+
 /**
  * @brief Starts playback
  * 
@@ -287,6 +398,9 @@ KIT_API Kit_PlayerState Kit_GetPlayerState(const Kit_Player *player);
  * - If player is paused, will resume playback.
  * - If player is stopped, will begin playback (and background decoding).
  * 
+ * The state changes right away, but the rest of the work is done asynchronously by the
+ * demuxer worker. Until it is done, data getters return nothing.
+ * 
  * @param player Player instance
  */
 KIT_API void Kit_PlayerPlay(Kit_Player *player);
@@ -299,6 +413,8 @@ KIT_API void Kit_PlayerPlay(Kit_Player *player);
  * - If player is paused, will stop playback.
  * - If player is started, will stop playback (and background decoding).
  * 
+ * The state changes right away; buffers are cleared asynchronously by the demuxer worker.
+ * 
  * @param player Player instance
  */
 KIT_API void Kit_PlayerStop(Kit_Player *player);
@@ -311,6 +427,8 @@ KIT_API void Kit_PlayerStop(Kit_Player *player);
  * - If player is stopped, will do nothing.
  * - If player is started, will pause playback (and background decoding).
  * 
+ * The state changes right away; clocks are adjusted asynchronously by the demuxer worker.
+ * 
  * @param player Player instance
  */
 KIT_API void Kit_PlayerPause(Kit_Player *player);
@@ -322,12 +440,81 @@ KIT_API void Kit_PlayerPause(Kit_Player *player);
  * 
  * This may not work for network or custom sources!
  * 
+ * The seek is performed asynchronously by the demuxer worker. Until it is done, data getters
+ * return nothing. Unseekable sources and invalid targets are detected right away, and reported
+ * via Kit_GetError(). If the seek fails later on (for example due to an I/O error), playback just
+ * continues from the current position; check Kit_GetPlayerSeekError() to find out about it.
+ * 
  * @param player Player instance
  * @param time Timestamp to seek to in seconds
- * @return 0 on success, 1 on failure.
+ * @return 0 if the seek was queued, 1 if the source can not be seeked or the queue is full.
  */
 KIT_API int Kit_PlayerSeek(Kit_Player *player, double time);
 
+/**
+ * @brief Checks if an asynchronous seek has failed
+ * 
+ * Seeks queued by Kit_PlayerSeek(), and the repositioning done when a suspended player is resumed,
+ * are performed by the demuxer worker. If one of them fails, the error is kept until it is
+ * fetched with this function. The error is then cleared, and a more detailed message is made
+ * available via Kit_GetError().
+ * 
+ * @param player Player instance
+ * @return 0 if no seek has failed since the last call, 1 otherwise.
+ */
+KIT_API int Kit_GetPlayerSeekError(Kit_Player *player);
+
+/**
+ * @brief Releases the heavy resources of a player
+ * 
+ * Pauses playback if it is running, then drops all buffered packets and decoded data, closes the
+ * codecs (and their threads), and frees converter contexts and output buffers. The source and the
+ * player itself stay open. Use this for players that are hidden or paused for a long time.
+ * 
+ * Resources are reallocated by Kit_PlayerResume(), or implicitly when playback is started or
+ * resumed, or a seek is requested. Playback then continues from the position it was suspended at.
+ * 
+ * Also see KIT_HINT_IDLE_SUSPEND_MS for doing this automatically.
+ * 
+ * Suspend is performed asynchronously by the demuxer worker.
+ * 
+ * @param player Player instance
+ * @return 0 on success, 1 if the request could not be queued.
+ */
+KIT_API int Kit_PlayerSuspend(Kit_Player *player);
+
+/**
+ * @brief Reallocates resources released by Kit_PlayerSuspend()
+ * 
+ * Reopens the codecs and seeks the source back to the position the player was suspended at, so that
+ * decoding can start ahead of playback. Player state is not changed; use Kit_PlayerPlay() to
+ * continue playback. Does nothing if the player is not suspended.
+ * 
+ * This is performed asynchronously by the demuxer worker. Errors are reported via Kit_GetError().
+ * 
+ * @param player Player instance
+ * @return 0 on success, 1 if the request could not be queued.
+ */
+KIT_API int Kit_PlayerResume(Kit_Player *player);
+
+/**
+ * @brief Runs demuxing and decoding work for a player
+ * 
+ * This is only useful for players created while the KIT_HINT_MANUAL_PUMP hint is set. Such players
+ * do not start any threads, and nothing gets demuxed or decoded unless this function is called
+ * regularly, eg. from your own job system. For other players this does nothing.
+ * 
+ * Work is run in small steps until either there is nothing left to do, or the time budget is spent.
+ * A single step may run past the budget, so leave some headroom. If budget is 0, each worker
+ * is given exactly one step. This must not be called for the same player from multiple
+ * threads at once, or after the player has been closed.
+ * 
+ * @param player Player instance
+ * @param budget_us Time budget in microseconds
+ * @return 1 if there may be more work to do, 0 if everything was idle
+ */
+KIT_API int Kit_PlayerPump(Kit_Player *player, int budget_us);
+
 /**
  * @brief Get the duration of the source
  * 
@@ -11,34 +11,42 @@
 #include "kitchensink/internal/kitlibstate.h"
 #include "kitchensink/internal/utils/kithelpers.h"
 #include "kitchensink/internal/audio/kitaudio.h"
-#include "kitchensink/internal/utils/kitringbuffer.h"
 
 #if LIBAVUTIL_VERSION_MAJOR < 58
 #define OLD_CHANNEL_LAYOUT
 #endif
 
 #define KIT_AUDIO_SYNC_THRESHOLD 0.05
+#define KIT_AUDIO_DEFAULT_FRAME_SAMPLES 2048
+
+// Decoded PCM data for the whole decoder. Resampler writes directly into this, and the audio
+// output reads from it. Positions are free-running byte counters; the data of a single packet
+// never wraps around the end, so that both sides can use it as a flat buffer.
+typedef struct Kit_AudioRing {
+    SDL_atomic_t read_p;      ///< Consumed up to here (written by consumer)
+    unsigned int write_p;     ///< Produced up to here (producer only)
+    unsigned int size;        ///< Size of the ring in bytes (power of two)
+    unsigned char *data;
+} Kit_AudioRing;
+
+// Marks a single decoded frame inside the PCM ring.
+typedef struct Kit_AudioPacket {
+    double pts;               ///< Presentation timestamp of the next unread byte
+    unsigned int start;       ///< Next unread byte (ring position)
+    unsigned int end;         ///< End of the frame data (ring position)
+    Kit_AudioRing *ring;
+} Kit_AudioPacket;
 
 typedef struct Kit_AudioDecoder {
     SwrContext *swr;
     AVFrame *scratch_frame;
+    bool frame_pending;       ///< Scratch frame is waiting for room in the PCM ring
+    Kit_AudioRing ring;       ///< PCM data for all decoded packets
+    Kit_AudioPacket *packets; ///< Preallocated packets, used in order (one for each output buffer slot)
+    unsigned int packet_count;
+    unsigned int packet_next;
 } Kit_AudioDecoder;
 
-typedef struct Kit_AudioPacket {
-    double pts;
-    size_t original_size;
-    Kit_RingBuffer *rb;
-} Kit_AudioPacket;
-
-
-static Kit_AudioPacket* _CreateAudioPacket(const char* data, size_t len, double pts) {
-    Kit_AudioPacket *p = calloc(1, sizeof(Kit_AudioPacket));
-    p->rb = Kit_CreateRingBuffer(len);
-    Kit_WriteRingBuffer(p->rb, data, len);
-    p->pts = pts;
-    return p;
-}
-
 static enum AVSampleFormat _FindAVSampleFormat(int format) {
     switch(format) {
         case AUDIO_U8: return AV_SAMPLE_FMT_U8;
@@ -117,66 +125,88 @@ static int _FindSignedness(enum AVSampleFormat fmt) {
 }
 
 static void free_out_audio_packet_cb(void *packet) {
+    // Packets are consumed in order, so everything up to the end of this one is free now.
+    // This must be done before the packet is advanced, since the producer reuses it after that.
     Kit_AudioPacket *p = packet;
-    Kit_DestroyRingBuffer(p->rb);
-    free(p);
+    SDL_AtomicSet(&p->ring->read_p, (int)p->end);
 }
 
-static void dec_read_audio(const Kit_Decoder *dec) {
-    const Kit_AudioDecoder *audio_dec = dec->userdata;
-    int len;
-    int dst_linesize;
+// Returns 0 if the scratch frame was handled, 1 if there is no room for it yet.
+static int _WriteAudioFrame(Kit_Decoder *dec, Kit_AudioDecoder *audio_dec) {
+    Kit_AudioRing *ring = &audio_dec->ring;
+    Kit_AudioPacket *out_packet = NULL;
+    const int frame_bytes = dec->output.bytes * dec->output.channels;
+    unsigned char *dst = NULL;
+    unsigned int read_p;
+    unsigned int start;
+    unsigned int need;
     int dst_nb_samples;
-    int dst_bufsize;
+    int len;
     double pts;
-    unsigned char **dst_data;
-    Kit_AudioPacket *out_packet = NULL;
-    int ret = 0;
 
-    // Pull decoded frames out when ready and if we have room in decoder output buffer
-    while(!ret && Kit_CanWriteDecoderOutput(dec)) {
-        ret = avcodec_receive_frame(dec->codec_ctx, audio_dec->scratch_frame);
-        if(!ret) {
-            dst_nb_samples = av_rescale_rnd(
-                audio_dec->scratch_frame->nb_samples,
-                dec->output.samplerate,  // Target samplerate
-                dec->codec_ctx->sample_rate,  // Source samplerate
-                AV_ROUND_UP);
-
-            av_samples_alloc_array_and_samples(
-                &dst_data,
-                &dst_linesize,
-                dec->output.channels,
-                dst_nb_samples,
-                _FindAVSampleFormat(dec->output.format),
-                0);
-
-            len = swr_convert(
-                audio_dec->swr,
-                dst_data,
-                dst_nb_samples,
-                (const unsigned char **)audio_dec->scratch_frame->extended_data,
-                audio_dec->scratch_frame->nb_samples);
-
-            dst_bufsize = av_samples_get_buffer_size(
-                &dst_linesize,
-                dec->output.channels,
-                len,
-                _FindAVSampleFormat(dec->output.format), 1);
-
-            // Get presentation timestamp
-            pts = audio_dec->scratch_frame->best_effort_timestamp;
-            pts *= av_q2d(dec->format_ctx->streams[dec->stream_index]->time_base);
-
-            // Lock, write to audio buffer, unlock
-            out_packet = _CreateAudioPacket(
-                (char*)dst_data[0], (size_t)dst_bufsize, pts);
-            Kit_WriteDecoderOutput(dec, out_packet);
-
-            // Free temps
-            av_freep(&dst_data[0]);
-            av_freep(&dst_data);
+    dst_nb_samples = av_rescale_rnd(
+        audio_dec->scratch_frame->nb_samples,
+        dec->output.samplerate,  // Target samplerate
+        dec->codec_ctx->sample_rate,  // Source samplerate
+        AV_ROUND_UP);
+    need = (unsigned int)(dst_nb_samples * frame_bytes);
+    if(need > ring->size) {
+        return 0;  // Can never fit; drop it instead of stalling.
+    }
+
+    // If the frame would wrap around the end of the ring, skip to the beginning.
+    start = ring->write_p;
+    if((start & (ring->size - 1)) + need > ring->size) {
+        start += ring->size - (start & (ring->size - 1));
+    }
+    read_p = (unsigned int)SDL_AtomicGet(&ring->read_p);
+    if(start + need - read_p > ring->size) {
+        return 1;
+    }
+
+    // Resample straight into the ring.
+    dst = ring->data + (start & (ring->size - 1));
+    len = swr_convert(
+        audio_dec->swr,
+        &dst,
+        dst_nb_samples,
+        (const unsigned char **)audio_dec->scratch_frame->extended_data,
+        audio_dec->scratch_frame->nb_samples);
+    if(len <= 0) {
+        return 0;
+    }
+
+    // Get presentation timestamp
+    pts = audio_dec->scratch_frame->best_effort_timestamp;
+    pts *= av_q2d(dec->format_ctx->streams[dec->stream_index]->time_base);
+
+    // Publish the data. Ring position is only read by us, output buffer handles the ordering.
+    out_packet = &audio_dec->packets[audio_dec->packet_next++ % audio_dec->packet_count];
+    out_packet->pts = pts;
+    out_packet->start = start;
+    out_packet->end = start + (unsigned int)(len * frame_bytes);
+    out_packet->ring = ring;
+    ring->write_p = out_packet->end;
+    Kit_WriteDecoderOutputItem(
+        dec, out_packet, out_packet->end - out_packet->start, (double)len / dec->output.samplerate);
+    dec->decoded_pts = pts + (double)len / dec->output.samplerate;
+    return 0;
+}
+
+static void dec_read_audio(Kit_Decoder *dec) {
+    Kit_AudioDecoder *audio_dec = dec->userdata;
+
+    // Pull decoded frames out when ready and if we have room in decoder output buffer.
+    // If the PCM ring is full, the frame is kept until there is room again.
+    while(Kit_CanWriteDecoderOutput(dec)) {
+        if(!audio_dec->frame_pending) {
+            if(avcodec_receive_frame(dec->codec_ctx, audio_dec->scratch_frame) != 0)
+                break;
+            audio_dec->frame_pending = true;
         }
+        if(_WriteAudioFrame(dec, audio_dec) != 0)
+            break;
+        audio_dec->frame_pending = false;
     }
 }
 
@@ -198,10 +228,54 @@ static int dec_decode_audio_cb(Kit_Decoder *dec, AVPacket *in_packet) {
     return 0;
 }
 
+static void dec_flush_audio_cb(Kit_Decoder *dec) {
+    Kit_AudioDecoder *audio_dec = dec->userdata;
+    audio_dec->frame_pending = false;
+}
+
+static void dec_suspend_audio_cb(Kit_Decoder *dec) {
+    // Output buffer is already empty, so nothing points to the ring anymore.
+    Kit_AudioDecoder *audio_dec = dec->userdata;
+    audio_dec->frame_pending = false;
+    av_frame_unref(audio_dec->scratch_frame);
+    swr_close(audio_dec->swr);
+    if(audio_dec->ring.data != NULL) {
+        Kit_RemoveMemory(dec->memory, KIT_MEMORY_AUDIO, audio_dec->ring.size);
+        free(audio_dec->ring.data);
+        audio_dec->ring.data = NULL;
+    }
+}
+
+static int dec_resume_audio_cb(Kit_Decoder *dec) {
+    Kit_AudioDecoder *audio_dec = dec->userdata;
+    if(audio_dec->ring.data == NULL) {
+        audio_dec->ring.data = malloc(audio_dec->ring.size);
+        if(audio_dec->ring.data == NULL) {
+            Kit_SetError("Unable to allocate audio output buffer");
+            return 1;
+        }
+        Kit_AddMemory(dec->memory, KIT_MEMORY_AUDIO, audio_dec->ring.size);
+        audio_dec->ring.write_p = 0;
+        SDL_AtomicSet(&audio_dec->ring.read_p, 0);
+    }
+    if(swr_init(audio_dec->swr) != 0) {
+        Kit_SetError("Unable to initialize audio resampler context");
+        return 1;
+    }
+    return 0;
+}
+
 static void dec_close_audio_cb(Kit_Decoder *dec) {
     if(dec == NULL) return;
 
+    // Output packets point to the ring, so get rid of them first.
     Kit_AudioDecoder *audio_dec = dec->userdata;
+    Kit_ClearBuffer(dec->buffer[KIT_DEC_BUF_OUT]);
+    if(audio_dec->ring.data != NULL) {
+        Kit_RemoveMemory(dec->memory, KIT_MEMORY_AUDIO, audio_dec->ring.size);
+        free(audio_dec->ring.data);
+    }
+    free(audio_dec->packets);
     if(audio_dec->scratch_frame != NULL) {
         av_frame_free(&audio_dec->scratch_frame);
     }
@@ -211,13 +285,15 @@ static void dec_close_audio_cb(Kit_Decoder *dec) {
     free(audio_dec);
 }
 
-Kit_Decoder* Kit_CreateAudioDecoder(const Kit_Source *src, int stream_index) {
+Kit_Decoder* Kit_CreateAudioDecoder(const Kit_Source *src, int stream_index, Kit_MemoryCounter *memory) {
     assert(src != NULL);
     if(stream_index < 0) {
         return NULL;
     }
 
     const Kit_LibraryState *state = Kit_GetLibraryState();
+    unsigned int frame_samples;
+    unsigned int ring_size;
 
     // First the generic decoder component ...
     Kit_Decoder *dec = Kit_CreateDecoder(
@@ -225,7 +301,9 @@ Kit_Decoder* Kit_CreateAudioDecoder(const Kit_Source *src, int stream_index) {
         stream_index,
         state->audio_buf_frames,
         free_out_audio_packet_cb,
-        state->thread_count);
+        state->thread_count,
+        0,
+        memory);
     if(dec == NULL) {
         goto EXIT_0;
     }
@@ -290,13 +368,46 @@ Kit_Decoder* Kit_CreateAudioDecoder(const Kit_Source *src, int stream_index) {
         goto EXIT_3;
     }
 
+    // Preallocate the PCM ring, and a packet for each output buffer slot. Ring is sized so that
+    // each slot could hold a full frame. If there is a byte limit, that is all we need (as long
+    // as a couple of frames still fit).
+    frame_samples = dec->codec_ctx->frame_size > 0 ? dec->codec_ctx->frame_size : KIT_AUDIO_DEFAULT_FRAME_SAMPLES;
+    ring_size = state->audio_buf_frames * frame_samples * output.bytes * output.channels;
+    if(state->audio_buf_bytes > 0 && state->audio_buf_bytes < ring_size) {
+        ring_size = state->audio_buf_bytes;
+        if(ring_size < 2 * frame_samples * output.bytes * output.channels) {
+            ring_size = 2 * frame_samples * output.bytes * output.channels;
+        }
+    }
+    Kit_SetDecoderInputLimits(dec, state->audio_in_bytes, state->audio_in_ms);
+    Kit_SetDecoderOutputLimits(dec, state->audio_buf_bytes, state->audio_buf_ms);
+    audio_dec->ring.size = 1;
+    while(audio_dec->ring.size < ring_size) {
+        audio_dec->ring.size <<= 1;
+    }
+    audio_dec->ring.data = malloc(audio_dec->ring.size);
+    audio_dec->packet_count = state->audio_buf_frames;
+    audio_dec->packets = calloc(audio_dec->packet_count, sizeof(Kit_AudioPacket));
+    if(audio_dec->ring.data == NULL || audio_dec->packets == NULL) {
+        Kit_SetError("Unable to allocate audio output buffer");
+        goto EXIT_4;
+    }
+    Kit_AddMemory(dec->memory, KIT_MEMORY_AUDIO, audio_dec->ring.size);
+
     // Set callbacks and userdata, and we're go
     dec->dec_decode = dec_decode_audio_cb;
+    dec->dec_flush = dec_flush_audio_cb;
+    dec->dec_suspend = dec_suspend_audio_cb;
+    dec->dec_resume = dec_resume_audio_cb;
     dec->dec_close = dec_close_audio_cb;
     dec->userdata = audio_dec;
     dec->output = output;
     return dec;
 
+EXIT_4:
+    free(audio_dec->ring.data);
+    free(audio_dec->packets);
+    swr_free(&audio_dec->swr);
 EXIT_3:
     av_frame_free(&audio_dec->scratch_frame);
 EXIT_2:
@@ -323,6 +434,7 @@ int Kit_GetAudioDecoderData(Kit_Decoder *dec, unsigned char *buf, int len) {
     int bytes_per_sample = 0;
     double bytes_per_second = 0;
     double sync_ts = 0;
+    unsigned int mask = 0;
 
     // First, peek the next packet. Make sure we have something to read.
     packet = Kit_PeekDecoderOutput(dec);
@@ -338,18 +450,22 @@ int Kit_GetAudioDecoderData(Kit_Decoder *dec, unsigned char *buf, int len) {
         return 0;
     }
     while(packet != NULL && packet->pts < sync_ts - KIT_AUDIO_SYNC_THRESHOLD) {
-        Kit_AdvanceDecoderOutput(dec);
         free_out_audio_packet_cb(packet);
+        Kit_AdvanceDecoderOutput(dec);
         packet = Kit_PeekDecoderOutput(dec);
     }
     if(packet == NULL) {
         return 0;
     }
 
-    // Read data from packet ringbuffer
+    // Copy data from the PCM ring. Packet data is never split, so this is a single copy.
     if(len > 0) {
-        ret = Kit_ReadRingBuffer(packet->rb, (char*)buf, len);
+        ret = packet->end - packet->start;
+        ret = (len < ret) ? len : ret;
         if(ret) {
+            mask = packet->ring->size - 1;
+            memcpy(buf, packet->ring->data + (packet->start & mask), (size_t)ret);
+            packet->start += (unsigned int)ret;
             bytes_per_sample = dec->output.bytes * dec->output.channels;
             bytes_per_second = bytes_per_sample * dec->output.samplerate;
             packet->pts += ((double)ret) / bytes_per_second;
@@ -357,11 +473,11 @@ int Kit_GetAudioDecoderData(Kit_Decoder *dec, unsigned char *buf, int len) {
     }
     dec->clock_pos = packet->pts;
 
-    // If ringbuffer is cleared, kill packet and advance buffer.
+    // If packet is fully read, release its data and advance buffer.
     // Otherwise, forward the pts value for the current packet.
-    if(Kit_GetRingBufferLength(packet->rb) == 0) {
-        Kit_AdvanceDecoderOutput(dec);
+    if(packet->start == packet->end) {
         free_out_audio_packet_cb(packet);
+        Kit_AdvanceDecoderOutput(dec);
     }
     return ret;
 }
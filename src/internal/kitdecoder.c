@@ -1,62 +1,63 @@
 #include <stdlib.h>
+#include <limits.h>
 #include <assert.h>
 
 #include <libavformat/avformat.h>
 
 #include "kitchensink/internal/kitdecoder.h"
+#include "kitchensink/internal/utils/kithelpers.h"
+#include "kitchensink/internal/utils/kitthread.h"
 #include "kitchensink/kiterror.h"
 
-#define BUFFER_IN_SIZE 256
+// Hard cap on queued input packets. Byte and duration limits should normally hit first.
+#define KIT_DEC_INPUT_MAX_PACKETS 4096
+#define KIT_DEC_LOW_HEADROOM 0.1
+#define KIT_DEC_MAX_LIMIT_MS (UINT_MAX / 1000)  // Larger millisecond limits would overflow in microseconds
+#define KIT_DEC_MAX_YIELD 0.05  // Longest time (seconds) a decoder waits on its yield_to decoder at once
 
 static void free_in_video_packet_cb(void *packet) {
     av_packet_free((AVPacket**)&packet);
 }
 
-Kit_Decoder* Kit_CreateDecoder(const Kit_Source *src, int stream_index, 
-                               int out_b_size, dec_free_packet_cb free_out_cb,
-                               int thread_count) {
-    assert(src != NULL);
-    assert(out_b_size > 0);
-    assert(thread_count >= 0);
+// Converts a duration to buffer cost units, saturating instead of overflowing.
+static unsigned int _ToMicroseconds(double seconds) {
+    if(seconds <= 0)
+        return 0;
+    if(seconds >= INT_MAX / 1000000.0)
+        return INT_MAX;
+    return (unsigned int)(seconds * 1000000);
+}
 
+static void _ReleaseInputPacket(const Kit_Decoder *dec, Kit_PacketPool *pool, AVPacket *packet) {
+    Kit_RemoveMemory(dec->memory, KIT_MEMORY_PACKETS, (size_t)packet->size);
+    Kit_ReleasePacket(pool, packet);
+}
+
+// Allocates an unopened codec context for the stream. This holds no threads or buffers yet.
+static AVCodecContext* _AllocCodecContext(const AVFormatContext *format_ctx, int stream_index,
+                                          int thread_count, int lowres) {
     AVCodecContext *codec_ctx = NULL;
-    AVDictionary *codec_opts = NULL;
     const AVCodec *codec = NULL;
-    AVFormatContext *format_ctx = src->format_ctx;
-    int bsizes[2] = {BUFFER_IN_SIZE, out_b_size};
-    dec_free_packet_cb free_hooks[2] = {free_in_video_packet_cb, free_out_cb};
-
-    // Make sure index seems correct
-    if(stream_index >= (int)format_ctx->nb_streams || stream_index < 0) {
-        Kit_SetError("Invalid stream %d", stream_index);
-        goto EXIT_0;
-    }
-    
-    // Allocate decoder and make sure allocation was a success
-    Kit_Decoder *dec = calloc(1, sizeof(Kit_Decoder));
-    if(dec == NULL) {
-        Kit_SetError("Unable to allocate kit decoder for stream %d", stream_index);
-        goto EXIT_0;
-    }
 
     // Find audio decoder
     codec = avcodec_find_decoder(format_ctx->streams[stream_index]->codecpar->codec_id);
     if(codec == NULL) {
         Kit_SetError("No suitable decoder found for stream %d", stream_index);
-        goto EXIT_1;
+        return NULL;
     }
 
     // Allocate a context for the codec
     codec_ctx = avcodec_alloc_context3(codec);
     if(codec_ctx == NULL) {
         Kit_SetError("Unable to allocate codec context for stream %d", stream_index);
-        goto EXIT_1;
+        return NULL;
     }
 
     // Copy params
     if(avcodec_parameters_to_context(codec_ctx, format_ctx->streams[stream_index]->codecpar) < 0) {
         Kit_SetError("Unable to copy codec context for stream %d", stream_index);
-        goto EXIT_2;
+        avcodec_free_context(&codec_ctx);
+        return NULL;
     }
 
     codec_ctx->pkt_timebase = format_ctx->streams[stream_index]->time_base;
@@ -71,19 +72,76 @@ Kit_Decoder* Kit_CreateDecoder(const Kit_Source *src, int stream_index,
         codec_ctx->thread_count = 1;  // Disable threading
     }
 
+    // Decode at reduced size, if possible. Other codecs can still cut some corners that are hard
+    // to see in a small picture.
+    if(lowres > 0 && codec->max_lowres > 0) {
+        codec_ctx->lowres = lowres < codec->max_lowres ? lowres : codec->max_lowres;
+    } else if(lowres > 0) {
+        codec_ctx->skip_idct = AVDISCARD_BIDIR;
+        codec_ctx->skip_loop_filter = AVDISCARD_ALL;
+        codec_ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+    }
+    return codec_ctx;
+}
+
+static int _OpenCodecContext(AVCodecContext *codec_ctx, int stream_index) {
+    AVDictionary *codec_opts = NULL;
+
     // This is required for ass_process_chunk()
     av_dict_set(&codec_opts, "sub_text_format", "ass", 0);
 
-    // Open the stream
-    if(avcodec_open2(codec_ctx, codec, &codec_opts) < 0) {
+    // Open the stream. Codec threads are created here, and they inherit our CPU affinity.
+    void *saved_affinity = Kit_PushThreadAffinity();
+    int open_ret = avcodec_open2(codec_ctx, codec_ctx->codec, &codec_opts);
+    Kit_PopThreadAffinity(saved_affinity);
+    av_dict_free(&codec_opts);
+    if(open_ret < 0) {
         Kit_SetError("Unable to open codec for stream %d", stream_index);
+        return 1;
+    }
+    return 0;
+}
+
+Kit_Decoder* Kit_CreateDecoder(const Kit_Source *src, int stream_index, 
+                               int out_b_size, dec_free_packet_cb free_out_cb,
+                               int thread_count, int lowres, Kit_MemoryCounter *memory) {
+    assert(src != NULL);
+    assert(out_b_size > 0);
+    assert(thread_count >= 0);
+
+    AVCodecContext *codec_ctx = NULL;
+    AVFormatContext *format_ctx = src->format_ctx;
+    int bsizes[2] = {KIT_DEC_INPUT_MAX_PACKETS, out_b_size};
+    dec_free_packet_cb free_hooks[2] = {free_in_video_packet_cb, free_out_cb};
+
+    // Make sure index seems correct
+    if(stream_index >= (int)format_ctx->nb_streams || stream_index < 0) {
+        Kit_SetError("Invalid stream %d", stream_index);
+        goto EXIT_0;
+    }
+    
+    // Allocate decoder and make sure allocation was a success
+    Kit_Decoder *dec = calloc(1, sizeof(Kit_Decoder));
+    if(dec == NULL) {
+        Kit_SetError("Unable to allocate kit decoder for stream %d", stream_index);
+        goto EXIT_0;
+    }
+
+    codec_ctx = _AllocCodecContext(format_ctx, stream_index, thread_count, lowres);
+    if(codec_ctx == NULL) {
+        goto EXIT_1;
+    }
+    if(_OpenCodecContext(codec_ctx, stream_index) != 0) {
         goto EXIT_2;
     }
 
     // Set index and codec
     dec->stream_index = stream_index;
+    dec->thread_count = thread_count;
+    dec->lowres = lowres;
     dec->codec_ctx = codec_ctx;
     dec->format_ctx = format_ctx;
+    dec->memory = memory;
 
     // Allocate input/output ringbuffers
     for(int i = 0; i < 2; i++) {
@@ -93,11 +151,9 @@ Kit_Decoder* Kit_CreateDecoder(const Kit_Source *src, int stream_index,
             goto EXIT_3;
         }
     }
-
-    // Create a lock for output buffer synchronization
     dec->output_lock = SDL_CreateMutex();
     if(dec->output_lock == NULL) {
-        Kit_SetError("Unable to allocate mutex for stream %d: %s", stream_index, SDL_GetError());
+        Kit_SetError("Unable to create output lock for stream %d: %s", stream_index, SDL_GetError());
         goto EXIT_3;
     }
 
@@ -110,7 +166,6 @@ EXIT_3:
     }
     avcodec_close(codec_ctx);
 EXIT_2:
-    av_dict_free(&codec_opts);
     avcodec_free_context(&codec_ctx);
 EXIT_1:
     free(dec);
@@ -120,9 +175,15 @@ EXIT_0:
 
 void Kit_CloseDecoder(Kit_Decoder *dec) {
     if(dec == NULL) return;
+    AVPacket *packet = NULL;
     if(dec->dec_close) {
         dec->dec_close(dec);
     }
+
+    // Packet pool may already be gone, so just free whatever is left in the input buffer.
+    while((packet = Kit_ReadBuffer(dec->buffer[KIT_DEC_BUF_IN])) != NULL) {
+        _ReleaseInputPacket(dec, NULL, packet);
+    }
     for(int i = 0; i < KIT_DEC_BUF_COUNT; i++) {
         Kit_DestroyBuffer(dec->buffer[i]);
     }
@@ -133,17 +194,12 @@ void Kit_CloseDecoder(Kit_Decoder *dec) {
 }
 
 int Kit_RunDecoder(Kit_Decoder *dec) {
-    if(dec == NULL) return 0;
+    if(dec == NULL || dec->suspended) return 0;
 
     AVPacket *in_packet;
-    int is_output_full = 1;
 
     // First, check if there is room in output buffer
-    if(SDL_LockMutex(dec->output_lock) == 0) {
-        is_output_full = Kit_IsBufferFull(dec->buffer[KIT_DEC_BUF_OUT]);
-        SDL_UnlockMutex(dec->output_lock);
-    }
-    if(is_output_full) {
+    if(Kit_IsBufferFull(dec->buffer[KIT_DEC_BUF_OUT])) {
         return 0;
     }
 
@@ -156,17 +212,56 @@ int Kit_RunDecoder(Kit_Decoder *dec) {
     // Run decoder with incoming packet
     if(dec->dec_decode(dec, in_packet) == 0) {
         Kit_AdvanceDecoderInput(dec);
-        av_packet_free(&in_packet);
+        _ReleaseInputPacket(dec, dec->packet_pool, in_packet);
         return 1;
     }
     return 0;
 }
 
-void Kit_ClearDecoderBuffers(const Kit_Decoder *dec) {
+void Kit_ClearDecoderBuffers(Kit_Decoder *dec) {
     if(dec == NULL) return;
     Kit_ClearDecoderInput(dec);
     Kit_ClearDecoderOutput(dec);
+    if(dec->suspended) return;  // Nothing in the codec to flush
     avcodec_flush_buffers(dec->codec_ctx);
+    if(dec->dec_flush) {
+        dec->dec_flush(dec);
+    }
+}
+
+// Drops all buffered data and swaps the codec context for an unopened one, so that codec threads
+// and internal buffers are freed. Info getters keep working from the unopened context.
+int Kit_SuspendDecoder(Kit_Decoder *dec) {
+    if(dec == NULL || dec->suspended) return 0;
+    AVCodecContext *codec_ctx = _AllocCodecContext(dec->format_ctx, dec->stream_index, dec->thread_count, dec->lowres);
+    if(codec_ctx == NULL) {
+        return 1;
+    }
+    Kit_ClearDecoderBuffers(dec);
+    if(dec->dec_suspend) {
+        dec->dec_suspend(dec);
+    }
+    avcodec_close(dec->codec_ctx);
+    avcodec_free_context(&dec->codec_ctx);
+    dec->codec_ctx = codec_ctx;
+    dec->suspended = true;
+    return 0;
+}
+
+int Kit_ResumeDecoder(Kit_Decoder *dec) {
+    if(dec == NULL || !dec->suspended) return 0;
+    if(dec->dec_resume && dec->dec_resume(dec) != 0) {
+        return 1;
+    }
+    if(_OpenCodecContext(dec->codec_ctx, dec->stream_index) != 0) {
+        // Stay suspended; release whatever dec_resume allocated.
+        if(dec->dec_suspend) {
+            dec->dec_suspend(dec);
+        }
+        return 1;
+    }
+    dec->suspended = false;
+    return 0;
 }
 
 // ---- Information API ----
@@ -199,6 +294,44 @@ int Kit_GetDecoderStreamIndex(const Kit_Decoder *dec) {
 
 // ---- Clock handling ----
 
+// Returns how far ahead of the playback clock decoded output reaches, in seconds.
+double Kit_GetDecoderHeadroom(const Kit_Decoder *dec) {
+    if(dec == NULL || Kit_IsDecoderOutputEmpty(dec))
+        return 0;
+    return dec->decoded_pts - (_GetSystemTime() - dec->clock_sync);
+}
+
+// Returns true if the decoder is about to run dry, but could decode more right now: it has
+// packets to decode, and room for the output.
+bool Kit_IsDecoderStarving(const Kit_Decoder *dec) {
+    if(dec == NULL || dec->suspended || Kit_IsDecoderInputEmpty(dec) || !Kit_CanWriteDecoderOutput(dec))
+        return false;
+    return Kit_GetDecoderHeadroom(dec) < KIT_DEC_LOW_HEADROOM;
+}
+
+// Returns true if the decoder should skip its turn so that its yield_to decoder can catch up.
+// Yielding is time limited, so that we keep making progress even if the other decoder stays
+// below the headroom threshold for a long time.
+bool Kit_ShouldDecoderYield(Kit_Decoder *dec) {
+    double now;
+    if(dec == NULL || !Kit_IsDecoderStarving(dec->yield_to)) {
+        if(dec != NULL) dec->yield_started = 0;
+        return false;
+    }
+    now = _GetSystemTime();
+    if(dec->yield_started <= 0) {
+        dec->yield_started = now;
+        return true;
+    }
+    if(now - dec->yield_started < KIT_DEC_MAX_YIELD) {
+        return true;
+    }
+
+    // Waited long enough; take a single step, then start over.
+    dec->yield_started = 0;
+    return false;
+}
+
 void Kit_SetDecoderClockSync(Kit_Decoder *dec, double sync) {
     if(dec == NULL)
         return;
@@ -213,9 +346,39 @@ void Kit_ChangeDecoderClockSync(Kit_Decoder *dec, double sync) {
 
 // ---- Input buffer handling ----
 
+// Input and output buffers are single-producer, single-consumer queues. Demuxer writes input and
+// decoder reads it; decoder writes output and the rendering side reads it. Only the producer side
+// is lock-free: consumer operations take a short spinlock inside the buffer. Input is cleared
+// only while the decoder worker is locked. Output is cleared from the control thread, so readers
+// hold the output lock for as long as they use a peeked item (see Kit_LockDecoderOutput()), and
+// clearing waits for them.
+
+// Input buffer is considered full when it holds max_bytes worth of packets, or max_ms worth
+// of packet durations, whichever comes first. Zero means no limit.
+void Kit_SetDecoderInputLimits(const Kit_Decoder *dec, unsigned int max_bytes, unsigned int max_ms) {
+    assert(dec != NULL);
+    if(max_ms > KIT_DEC_MAX_LIMIT_MS) max_ms = KIT_DEC_MAX_LIMIT_MS;
+    Kit_SetBufferLimits(dec->buffer[KIT_DEC_BUF_IN], max_bytes, max_ms * 1000);
+}
+
 int Kit_WriteDecoderInput(const Kit_Decoder *dec, AVPacket *packet) {
     assert(dec != NULL);
-    return Kit_WriteBuffer(dec->buffer[KIT_DEC_BUF_IN], packet);
+    // Packets without a known duration only count against the byte limit.
+    unsigned int duration_us = 0;
+    if(packet->duration > 0) {
+        duration_us = _ToMicroseconds(
+            packet->duration * av_q2d(dec->format_ctx->streams[dec->stream_index]->time_base));
+    }
+
+    // Accounted before writing, since decoder may release the packet right away.
+    Kit_AddMemory(dec->memory, KIT_MEMORY_PACKETS, (size_t)packet->size);
+    int ret = Kit_WriteBufferItem(dec->buffer[KIT_DEC_BUF_IN], packet, (unsigned int)packet->size, duration_us);
+    if(ret == 0) {
+        Kit_RaiseSignal(dec->decode_signal);
+    } else {
+        Kit_RemoveMemory(dec->memory, KIT_MEMORY_PACKETS, (size_t)packet->size);
+    }
+    return ret;
 }
 
 bool Kit_CanWriteDecoderInput(const Kit_Decoder *dec) {
@@ -223,9 +386,19 @@ bool Kit_CanWriteDecoderInput(const Kit_Decoder *dec) {
     return !Kit_IsBufferFull(dec->buffer[KIT_DEC_BUF_IN]);
 }
 
+unsigned int Kit_GetDecoderInputSize(const Kit_Decoder *dec) {
+    if(dec == NULL)
+        return 0;
+    return dec->buffer[KIT_DEC_BUF_IN]->size;
+}
+
 AVPacket* Kit_ReadDecoderInput(const Kit_Decoder *dec) {
     assert(dec != NULL);
-    return Kit_ReadBuffer(dec->buffer[KIT_DEC_BUF_IN]);
+    AVPacket *ret = Kit_ReadBuffer(dec->buffer[KIT_DEC_BUF_IN]);
+    if(ret != NULL) {
+        Kit_RaiseSignal(dec->demux_signal);
+    }
+    return ret;
 }
 
 AVPacket* Kit_PeekDecoderInput(const Kit_Decoder *dec) {
@@ -233,94 +406,106 @@ AVPacket* Kit_PeekDecoderInput(const Kit_Decoder *dec) {
     return Kit_PeekBuffer(dec->buffer[KIT_DEC_BUF_IN]);
 }
 
+bool Kit_IsDecoderInputEmpty(const Kit_Decoder *dec) {
+    assert(dec != NULL);
+    return Kit_GetBufferLength(dec->buffer[KIT_DEC_BUF_IN]) == 0;
+}
+
 void Kit_AdvanceDecoderInput(const Kit_Decoder *dec) {
     assert(dec != NULL);
     Kit_AdvanceBuffer(dec->buffer[KIT_DEC_BUF_IN]);
+    Kit_RaiseSignal(dec->demux_signal);
 }
 
 void Kit_ClearDecoderInput(const Kit_Decoder *dec) {
-    Kit_ClearBuffer(dec->buffer[KIT_DEC_BUF_IN]);
+    AVPacket *packet = NULL;
+    while((packet = Kit_ReadBuffer(dec->buffer[KIT_DEC_BUF_IN])) != NULL) {
+        _ReleaseInputPacket(dec, dec->packet_pool, packet);
+    }
+    Kit_RaiseSignal(dec->demux_signal);
 }
 
 // ---- Output buffer handling ----
 
+// Output buffer is considered full when it holds max_bytes worth of data, or max_ms worth
+// of presentation time, whichever comes first. Zero means no limit.
+void Kit_SetDecoderOutputLimits(const Kit_Decoder *dec, unsigned int max_bytes, unsigned int max_ms) {
+    assert(dec != NULL);
+    if(max_ms > KIT_DEC_MAX_LIMIT_MS) max_ms = KIT_DEC_MAX_LIMIT_MS;
+    Kit_SetBufferLimits(dec->buffer[KIT_DEC_BUF_OUT], max_bytes, max_ms * 1000);
+}
+
 int Kit_WriteDecoderOutput(const Kit_Decoder *dec, void *packet) {
     assert(dec != NULL);
-    int ret = 1;
-    if(SDL_LockMutex(dec->output_lock) == 0) {
-        ret = Kit_WriteBuffer(dec->buffer[KIT_DEC_BUF_OUT], packet);
-        SDL_UnlockMutex(dec->output_lock);
-    }
-    return ret;
+    return Kit_WriteBuffer(dec->buffer[KIT_DEC_BUF_OUT], packet);
+}
+
+int Kit_WriteDecoderOutputItem(const Kit_Decoder *dec, void *packet, unsigned int bytes, double duration) {
+    assert(dec != NULL);
+    return Kit_WriteBufferItem(dec->buffer[KIT_DEC_BUF_OUT], packet, bytes, _ToMicroseconds(duration));
 }
 
 void Kit_ClearDecoderOutput(const Kit_Decoder *dec) {
-    if(SDL_LockMutex(dec->output_lock) == 0) {
+    if(Kit_LockDecoderOutput(dec) == 0) {
         Kit_ClearBuffer(dec->buffer[KIT_DEC_BUF_OUT]);
-        SDL_UnlockMutex(dec->output_lock);
+        Kit_UnlockDecoderOutput(dec);
     }
+    Kit_RaiseSignal(dec->decode_signal);
+}
+
+// Output reader must hold this from peeking an item until it is done with it, since the item
+// may otherwise be freed by Kit_ClearDecoderOutput(). Only contended while clearing.
+int Kit_LockDecoderOutput(const Kit_Decoder *dec) {
+    assert(dec != NULL);
+    return SDL_LockMutex(dec->output_lock);
+}
+
+void Kit_UnlockDecoderOutput(const Kit_Decoder *dec) {
+    assert(dec != NULL);
+    SDL_UnlockMutex(dec->output_lock);
 }
 
 void* Kit_PeekDecoderOutput(const Kit_Decoder *dec) {
     assert(dec != NULL);
-    void *ret = NULL;
-    if(SDL_LockMutex(dec->output_lock) == 0) {
-        ret = Kit_PeekBuffer(dec->buffer[KIT_DEC_BUF_OUT]);
-        SDL_UnlockMutex(dec->output_lock);
-    }
-    return ret;
+    return Kit_PeekBuffer(dec->buffer[KIT_DEC_BUF_OUT]);
 }
 
 void* Kit_ReadDecoderOutput(const Kit_Decoder *dec) {
     assert(dec != NULL);
-    void *ret = NULL;
-    if(SDL_LockMutex(dec->output_lock) == 0) {
-        ret = Kit_ReadBuffer(dec->buffer[KIT_DEC_BUF_OUT]);
-        SDL_UnlockMutex(dec->output_lock);
+    void *ret = Kit_ReadBuffer(dec->buffer[KIT_DEC_BUF_OUT]);
+    if(ret != NULL) {
+        Kit_RaiseSignal(dec->decode_signal);
     }
     return ret;
 }
 
 bool Kit_CanWriteDecoderOutput(const Kit_Decoder *dec) {
     assert(dec != NULL);
-    bool ret = false;
-    if(SDL_LockMutex(dec->output_lock) == 0) {
-        ret = !Kit_IsBufferFull(dec->buffer[KIT_DEC_BUF_OUT]);
-        SDL_UnlockMutex(dec->output_lock);
-    }
-    return ret;
+    return !Kit_IsBufferFull(dec->buffer[KIT_DEC_BUF_OUT]);
 }
 
+bool Kit_IsDecoderOutputEmpty(const Kit_Decoder *dec) {
+    assert(dec != NULL);
+    return Kit_GetBufferLength(dec->buffer[KIT_DEC_BUF_OUT]) == 0;
+}
+
+// Callbacks run under the output lock (not the buffer spinlock), so items cannot be cleared or
+// advanced past while they are being looked at.
 void Kit_ForEachDecoderOutput(const Kit_Decoder *dec, Kit_ForEachItemCallback cb, void *userdata) {
     assert(dec != NULL);
-    if(SDL_LockMutex(dec->output_lock) == 0) {
+    if(Kit_LockDecoderOutput(dec) == 0) {
         Kit_ForEachItemInBuffer(dec->buffer[KIT_DEC_BUF_OUT], cb, userdata);
-        SDL_UnlockMutex(dec->output_lock);
+        Kit_UnlockDecoderOutput(dec);
     }
 }
 
 void Kit_AdvanceDecoderOutput(const Kit_Decoder *dec) {
     assert(dec != NULL);
-    if(SDL_LockMutex(dec->output_lock) == 0) {
-        Kit_AdvanceBuffer(dec->buffer[KIT_DEC_BUF_OUT]);
-        SDL_UnlockMutex(dec->output_lock);
-    }
+    Kit_AdvanceBuffer(dec->buffer[KIT_DEC_BUF_OUT]);
+    Kit_RaiseSignal(dec->decode_signal);
 }
 
 unsigned int Kit_GetDecoderOutputLength(const Kit_Decoder *dec) {
     assert(dec != NULL);
-    unsigned int len = 0;
-    if(SDL_LockMutex(dec->output_lock) == 0) {
-        len = Kit_GetBufferLength(dec->buffer[KIT_DEC_BUF_OUT]);
-        SDL_UnlockMutex(dec->output_lock);
-    }
-    return len;
-}
-
-int Kit_LockDecoderOutput(const Kit_Decoder *dec) {
-    return SDL_LockMutex(dec->output_lock);
-}
-
-void Kit_UnlockDecoderOutput(const Kit_Decoder *dec) {
-    SDL_UnlockMutex(dec->output_lock);
+    return Kit_GetBufferLength(dec->buffer[KIT_DEC_BUF_OUT]);
 }
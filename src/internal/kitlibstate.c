@@ -2,11 +2,38 @@
 #include "kitchensink/internal/kitlibstate.h"
 
 #ifdef LIBASS
-static Kit_LibraryState _librarystate = {0, 1, 0, 3, 64, 64, NULL, NULL};
+static Kit_LibraryState _librarystate = {0, 1, 0, 3, 64, 64, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    16777216, 1048576, 1048576, 0, 0, 0, 0, 0, 1, 0, 0, NULL, 0, NULL, 0, {0}, NULL, NULL};
 #else // LIBASS
-static Kit_LibraryState _librarystate = {0, 1, 0, 3, 64, 64};
+static Kit_LibraryState _librarystate = {0, 1, 0, 3, 64, 64, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    16777216, 1048576, 1048576, 0, 0, 0, 0, 0, 1, 0, 0, NULL, 0, NULL, 0, {0}};
 #endif // !LIBASS
 
 Kit_LibraryState* Kit_GetLibraryState() {
     return &_librarystate;
 }
+
+Kit_WorkerPool* Kit_GetLibraryWorkerPool() {
+    // Shared pool is created on first use, since hints are set after Kit_Init().
+    Kit_WorkerPool *pool = NULL;
+    SDL_AtomicLock(&_librarystate.worker_pool_lock);
+    if(_librarystate.worker_pool == NULL && _librarystate.worker_threads > 0) {
+        _librarystate.worker_pool = Kit_CreateWorkerPool(_librarystate.worker_threads);
+    }
+    pool = _librarystate.worker_pool;
+    SDL_AtomicUnlock(&_librarystate.worker_pool_lock);
+    return pool;
+}
+
+Kit_Parallel* Kit_GetLibraryConvertRunner() {
+    // Shared by all video decoders, so that the number of helper threads does not grow with
+    // the number of players. Created on first use, like the worker pool.
+    Kit_Parallel *runner = NULL;
+    SDL_AtomicLock(&_librarystate.convert_runner_lock);
+    if(_librarystate.convert_runner == NULL && _librarystate.convert_threads > 1) {
+        _librarystate.convert_runner = Kit_CreateParallel(_librarystate.convert_threads - 1);
+    }
+    runner = _librarystate.convert_runner;
+    SDL_AtomicUnlock(&_librarystate.convert_runner_lock);
+    return runner;
+}
@@ -55,6 +55,13 @@ void Kit_FreeAtlas(Kit_TextureAtlas *atlas) {
     free(atlas);
 }
 
+size_t Kit_GetAtlasMemorySize(const Kit_TextureAtlas *atlas) {
+    assert(atlas != NULL);
+    return sizeof(Kit_TextureAtlas)
+        + atlas->max_items * sizeof(Kit_TextureAtlasItem)
+        + atlas->max_shelves * sizeof(Kit_Shelf);
+}
+
 void Kit_SetItemAllocation(Kit_TextureAtlasItem *item, const SDL_Surface *surface, int x, int y) {
     assert(item != NULL);
 
@@ -75,12 +75,14 @@ static int dec_decode_subtitle_cb(Kit_Decoder *dec, AVPacket *in_packet) {
 static void dec_close_subtitle_cb(Kit_Decoder *dec) {
     if(dec == NULL) return;
     Kit_SubtitleDecoder *subtitle_dec = dec->userdata;
+    Kit_RemoveMemory(dec->memory, KIT_MEMORY_SUBTITLES, Kit_GetAtlasMemorySize(subtitle_dec->atlas));
     Kit_FreeAtlas(subtitle_dec->atlas);
     Kit_CloseSubtitleRenderer(subtitle_dec->renderer);
     free(subtitle_dec);
 }
 
-Kit_Decoder* Kit_CreateSubtitleDecoder(const Kit_Source *src, int stream_index, int video_w, int video_h, int screen_w, int screen_h) {
+Kit_Decoder* Kit_CreateSubtitleDecoder(const Kit_Source *src, int stream_index, int video_w, int video_h, int screen_w, int screen_h,
+                                       Kit_MemoryCounter *memory) {
     assert(src != NULL);
     assert(video_w >= 0);
     assert(video_h >= 0);
@@ -99,11 +101,14 @@ Kit_Decoder* Kit_CreateSubtitleDecoder(const Kit_Source *src, int stream_index,
         stream_index,
         state->subtitle_buf_frames,
         free_out_subtitle_packet_cb,
-        state->thread_count);
+        state->thread_count,
+        0,
+        memory);
     if(dec == NULL) {
         Kit_SetError("Unable to allocate subtitle decoder");
         goto EXIT_0;
     }
+    Kit_SetDecoderInputLimits(dec, state->subtitle_in_bytes, state->subtitle_in_ms);
 
     // ... then allocate the subtitle decoder
     Kit_SubtitleDecoder *subtitle_dec = calloc(1, sizeof(Kit_SubtitleDecoder));
@@ -151,6 +156,7 @@ Kit_Decoder* Kit_CreateSubtitleDecoder(const Kit_Source *src, int stream_index,
         Kit_SetError("Unable to allocate subtitle texture atlas");
         goto EXIT_3;
     }
+    Kit_AddMemory(dec->memory, KIT_MEMORY_SUBTITLES, Kit_GetAtlasMemorySize(subtitle_dec->atlas));
 
     // Set callbacks and userdata, and we're go
     dec->dec_decode = dec_decode_subtitle_cb;
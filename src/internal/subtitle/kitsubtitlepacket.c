@@ -1,8 +1,13 @@
 #include "kitchensink/internal/subtitle/kitsubtitlepacket.h"
 
 
+static size_t _GetSurfaceSize(const SDL_Surface *surface) {
+    return (size_t)surface->pitch * (size_t)surface->h;
+}
+
 Kit_SubtitlePacket* Kit_CreateSubtitlePacket(
-        bool clear, double pts_start, double pts_end, int pos_x, int pos_y, SDL_Surface *surface)
+        bool clear, double pts_start, double pts_end, int pos_x, int pos_y, SDL_Surface *surface,
+        Kit_MemoryCounter *memory)
 {
     Kit_SubtitlePacket *p = calloc(1, sizeof(Kit_SubtitlePacket));
     p->pts_start = pts_start;
@@ -10,14 +15,19 @@ Kit_SubtitlePacket* Kit_CreateSubtitlePacket(
     p->x = pos_x;
     p->y = pos_y;
     p->surface = surface;
+    p->memory = memory;
     if(p->surface != NULL) {
         p->surface->refcount++; // We don't want to needlessly copy; instead increase refcount.
+        Kit_AddMemory(p->memory, KIT_MEMORY_SUBTITLES, _GetSurfaceSize(p->surface));
     }
     p->clear = clear;
     return p;
 }
 
 void Kit_FreeSubtitlePacket(Kit_SubtitlePacket *p) {
+    if(p->surface != NULL) {
+        Kit_RemoveMemory(p->memory, KIT_MEMORY_SUBTITLES, _GetSurfaceSize(p->surface));
+    }
     SDL_FreeSurface(p->surface);
     free(p);
 }
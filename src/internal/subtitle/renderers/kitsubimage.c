@@ -29,7 +29,7 @@ static void ren_render_image_cb(Kit_SubtitleRenderer *ren, void *sub_src, double
     // If this subtitle has no rects, we still need to clear screen from old subs
     if(sub->num_rects == 0) {
         Kit_WriteDecoderOutput(
-            ren->dec, Kit_CreateSubtitlePacket(true, start_pts, end_pts, 0, 0, NULL));
+            ren->dec, Kit_CreateSubtitlePacket(true, start_pts, end_pts, 0, 0, NULL, ren->dec->memory));
         return;
     }
 
@@ -51,7 +51,7 @@ static void ren_render_image_cb(Kit_SubtitleRenderer *ren, void *sub_src, double
         
         // Create a new packet and write it to output buffer
         Kit_WriteDecoderOutput(
-            ren->dec, Kit_CreateSubtitlePacket(false, start_pts, end_pts, r->x, r->y, dst));
+            ren->dec, Kit_CreateSubtitlePacket(false, start_pts, end_pts, r->x, r->y, dst, ren->dec->memory));
 
         // Free surfaces
         SDL_FreeSurface(src);
@@ -1,30 +1,70 @@
 #include <stdlib.h>
+#include <limits.h>
 #include <assert.h>
 
 #include "kitchensink/internal/utils/kitbuffer.h"
 
+// SDL atomics take non-const pointers, even for plain reads.
+#define LOAD(p) ((unsigned int)SDL_AtomicGet((SDL_atomic_t*)(p)))
+#define STORE(p, v) SDL_AtomicSet((p), (int)(v))
+#define READ_LOCK(b) SDL_AtomicLock((SDL_SpinLock*)&(b)->read_lock)
+#define READ_UNLOCK(b) SDL_AtomicUnlock((SDL_SpinLock*)&(b)->read_lock)
+
 Kit_Buffer* Kit_CreateBuffer(unsigned int size, Kit_BufferFreeCallback free_cb) {
+    assert(size > 0);
+    unsigned int slots = 1;
+    while(slots < size) {
+        slots <<= 1;
+    }
+
     Kit_Buffer *b = calloc(1, sizeof(Kit_Buffer));
     if(b == NULL) {
         return NULL;
     }
     b->size = size;
+    b->mask = slots - 1;
     b->free_cb = free_cb;
-    b->data = calloc(size, sizeof(void*));
-    if(b->data == NULL) {
+    b->data = calloc(slots, sizeof(void*));
+    b->costs = calloc(slots, sizeof(Kit_BufferItemCost));
+    if(b->data == NULL || b->costs == NULL) {
+        free(b->data);
+        free(b->costs);
         free(b);
         return NULL;
     }
     return b;
 }
 
+void Kit_SetBufferLimits(Kit_Buffer *buffer, unsigned int max_bytes, unsigned int max_duration) {
+    assert(buffer != NULL);
+    // Totals are kept in int atomics, so limits beyond that could never be reached.
+    buffer->max_bytes = max_bytes < INT_MAX ? max_bytes : INT_MAX;
+    buffer->max_duration = max_duration < INT_MAX ? max_duration : INT_MAX;
+}
+
+// Producer side. Clamps an item cost so that the total saturates at INT_MAX instead of overflowing.
+// Only the producer adds to the totals, so the room can only grow before the add lands.
+static unsigned int _ClampCost(const SDL_atomic_t *total, unsigned int cost) {
+    unsigned int room = INT_MAX - LOAD(total);
+    return cost < room ? cost : room;
+}
+
+// Consumer side; called with the read lock held, before the read position is moved past the slot.
+static void _ReleaseCost(Kit_Buffer *buffer, unsigned int read_p) {
+    const Kit_BufferItemCost *cost = &buffer->costs[read_p & buffer->mask];
+    SDL_AtomicAdd(&buffer->bytes, -(int)cost->bytes);
+    SDL_AtomicAdd(&buffer->duration, -(int)cost->duration);
+}
+
 unsigned int Kit_GetBufferLength(const Kit_Buffer *buffer) {
-    return buffer->write_p - buffer->read_p;
+    unsigned int read_p = LOAD(&buffer->read_p);
+    return LOAD(&buffer->write_p) - read_p;
 }
 
 void Kit_DestroyBuffer(Kit_Buffer *buffer) {
     if(buffer == NULL) return;
     Kit_ClearBuffer(buffer);
+    free(buffer->costs);
     free(buffer->data);
     free(buffer);
 }
@@ -40,65 +80,89 @@ void Kit_ClearBuffer(Kit_Buffer *buffer) {
 
 void* Kit_ReadBuffer(Kit_Buffer *buffer) {
     assert(buffer != NULL);
-    if(buffer->read_p < buffer->write_p) {
-        void *out = buffer->data[buffer->read_p % buffer->size];
-        buffer->data[buffer->read_p % buffer->size] = NULL;
-        buffer->read_p++;
-        if(buffer->read_p >= buffer->size) {
-            buffer->read_p = buffer->read_p % buffer->size;
-            buffer->write_p = buffer->write_p % buffer->size;
-        }
-        return out;
+    void *out = NULL;
+    READ_LOCK(buffer);
+    unsigned int read_p = LOAD(&buffer->read_p);
+    if(read_p != LOAD(&buffer->write_p)) {
+        out = buffer->data[read_p & buffer->mask];
+        _ReleaseCost(buffer, read_p);
+        STORE(&buffer->read_p, read_p + 1);
     }
-    return NULL;
+    READ_UNLOCK(buffer);
+    return out;
 }
 
 void* Kit_PeekBuffer(const Kit_Buffer *buffer) {
     assert(buffer != NULL);
-    if(buffer->read_p < buffer->write_p) {
-        return buffer->data[buffer->read_p % buffer->size];
+    void *out = NULL;
+    READ_LOCK(buffer);
+    unsigned int read_p = LOAD(&buffer->read_p);
+    if(read_p != LOAD(&buffer->write_p)) {
+        out = buffer->data[read_p & buffer->mask];
     }
-    return NULL;
+    READ_UNLOCK(buffer);
+    return out;
 }
 
 void Kit_AdvanceBuffer(Kit_Buffer *buffer) {
     assert(buffer != NULL);
-    if(buffer->read_p < buffer->write_p) {
-        buffer->data[buffer->read_p % buffer->size] = NULL;
-        buffer->read_p++;
-        if(buffer->read_p >= buffer->size) {
-            buffer->read_p = buffer->read_p % buffer->size;
-            buffer->write_p = buffer->write_p % buffer->size;
-        }
+    READ_LOCK(buffer);
+    unsigned int read_p = LOAD(&buffer->read_p);
+    if(read_p != LOAD(&buffer->write_p)) {
+        _ReleaseCost(buffer, read_p);
+        STORE(&buffer->read_p, read_p + 1);
     }
+    READ_UNLOCK(buffer);
 }
 
+// Consumer side. Callbacks are not run under the read lock, since they may take arbitrarily long;
+// the caller must make sure that nobody else consumes items while this runs.
 void Kit_ForEachItemInBuffer(const Kit_Buffer *buffer, Kit_ForEachItemCallback cb, void *userdata) {
-    unsigned int read_p = buffer->read_p;
-    unsigned int write_p = buffer->write_p;
-    while(read_p < write_p) {
-        cb(buffer->data[read_p++ % buffer->size], userdata);
-        if(read_p >= buffer->size) {
-            read_p = read_p % buffer->size;
-            write_p = write_p % buffer->size;
-        }
+    READ_LOCK(buffer);
+    unsigned int read_p = LOAD(&buffer->read_p);
+    unsigned int write_p = LOAD(&buffer->write_p);
+    READ_UNLOCK(buffer);
+    while(read_p != write_p) {
+        cb(buffer->data[read_p++ & buffer->mask], userdata);
     }
 }
 
 int Kit_WriteBuffer(Kit_Buffer *buffer, void *ptr) {
+    return Kit_WriteBufferItem(buffer, ptr, 0, 0);
+}
+
+int Kit_WriteBufferItem(Kit_Buffer *buffer, void *ptr, unsigned int bytes, unsigned int duration) {
     assert(buffer != NULL);
     assert(ptr != NULL);
 
-    if(!Kit_IsBufferFull(buffer)) {
-        buffer->data[buffer->write_p % buffer->size] = ptr;
-        buffer->write_p++;
+    // Slot must be filled before the new write position is published to the consumer.
+    // Byte and duration limits are soft; they are checked by the producer via Kit_IsBufferFull().
+    unsigned int write_p = LOAD(&buffer->write_p);
+    if(write_p - LOAD(&buffer->read_p) < buffer->size) {
+        bytes = _ClampCost(&buffer->bytes, bytes);
+        duration = _ClampCost(&buffer->duration, duration);
+        buffer->data[write_p & buffer->mask] = ptr;
+        buffer->costs[write_p & buffer->mask].bytes = bytes;
+        buffer->costs[write_p & buffer->mask].duration = duration;
+        SDL_AtomicAdd(&buffer->bytes, (int)bytes);
+        SDL_AtomicAdd(&buffer->duration, (int)duration);
+        STORE(&buffer->write_p, write_p + 1);
         return 0;
     }
     return 1;
 }
 
 int Kit_IsBufferFull(const Kit_Buffer *buffer) {
-    int len = buffer->write_p - buffer->read_p;
-    int k = (len >= buffer->size);
-    return k;
+    // Item count is a hard limit. Others only apply if there is something in the buffer, so
+    // that a single item larger than the limits still gets through.
+    unsigned int length = Kit_GetBufferLength(buffer);
+    if(length >= buffer->size)
+        return 1;
+    if(length == 0)
+        return 0;
+    if(buffer->max_bytes > 0 && LOAD(&buffer->bytes) >= buffer->max_bytes)
+        return 1;
+    if(buffer->max_duration > 0 && LOAD(&buffer->duration) >= buffer->max_duration)
+        return 1;
+    return 0;
 }
@@ -0,0 +1,72 @@
+#include <assert.h>
+#include <string.h>
+
+#include "kitchensink/internal/kitlibstate.h"
+#include "kitchensink/internal/utils/kitmemory.h"
+
+static void _Add(Kit_MemoryCounter *counter, int category, size_t bytes) {
+    Kit_MemoryStats *stats = &counter->stats;
+    SDL_AtomicLock(&counter->lock);
+    stats->current[category] += bytes;
+    stats->total += bytes;
+    if(stats->current[category] > stats->peak[category]) {
+        stats->peak[category] = stats->current[category];
+    }
+    if(stats->total > stats->total_peak) {
+        stats->total_peak = stats->total;
+    }
+    SDL_AtomicUnlock(&counter->lock);
+}
+
+static void _Remove(Kit_MemoryCounter *counter, int category, size_t bytes) {
+    Kit_MemoryStats *stats = &counter->stats;
+    SDL_AtomicLock(&counter->lock);
+    assert(stats->current[category] >= bytes);
+    stats->current[category] -= bytes;
+    stats->total -= bytes;
+    SDL_AtomicUnlock(&counter->lock);
+}
+
+/**
+  * Records an allocation.
+  * @param counter Counter to update (may be NULL; library-wide counter is always updated)
+  * @param category Memory category (KIT_MEMORY_*)
+  * @param bytes Allocation size
+  */
+void Kit_AddMemory(Kit_MemoryCounter *counter, int category, size_t bytes) {
+    assert(category >= 0 && category < KIT_MEMORY_COUNT);
+    if(counter != NULL) {
+        _Add(counter, category, bytes);
+    }
+    _Add(&Kit_GetLibraryState()->memory, category, bytes);
+}
+
+/**
+  * Records a release of previously recorded allocation.
+  * @param counter Counter to update (may be NULL; library-wide counter is always updated)
+  * @param category Memory category (KIT_MEMORY_*)
+  * @param bytes Allocation size
+  */
+void Kit_RemoveMemory(Kit_MemoryCounter *counter, int category, size_t bytes) {
+    assert(category >= 0 && category < KIT_MEMORY_COUNT);
+    if(counter != NULL) {
+        _Remove(counter, category, bytes);
+    }
+    _Remove(&Kit_GetLibraryState()->memory, category, bytes);
+}
+
+/**
+  * Takes a consistent snapshot of the counter.
+  * @param counter Counter to read (may be NULL, in which case stats are zeroed)
+  * @param stats Target for the snapshot
+  */
+void Kit_GetMemoryCounterStats(Kit_MemoryCounter *counter, Kit_MemoryStats *stats) {
+    assert(stats != NULL);
+    if(counter == NULL) {
+        memset(stats, 0, sizeof(Kit_MemoryStats));
+        return;
+    }
+    SDL_AtomicLock(&counter->lock);
+    memcpy(stats, &counter->stats, sizeof(Kit_MemoryStats));
+    SDL_AtomicUnlock(&counter->lock);
+}
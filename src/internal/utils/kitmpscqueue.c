@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "kitchensink/internal/utils/kitmpscqueue.h"
+
+/**
+  * Creates a new queue. Size is rounded up to the next power of two.
+  * @param size Minimum number of items the queue can hold
+  * @param item_size Size of a single item in bytes
+  * @return Queue handle or NULL on failure
+  */
+Kit_MPSCQueue* Kit_CreateMPSCQueue(unsigned int size, size_t item_size) {
+    assert(size > 0);
+    assert(item_size > 0);
+    unsigned int slots = 1;
+    while(slots < size) {
+        slots <<= 1;
+    }
+
+    Kit_MPSCQueue *queue = calloc(1, sizeof(Kit_MPSCQueue));
+    if(queue == NULL) {
+        goto EXIT_0;
+    }
+    queue->mask = slots - 1;
+    queue->item_size = item_size;
+    queue->seq = calloc(slots, sizeof(SDL_atomic_t));
+    if(queue->seq == NULL) {
+        goto EXIT_1;
+    }
+    queue->data = calloc(slots, item_size);
+    if(queue->data == NULL) {
+        goto EXIT_2;
+    }
+
+    // Slot is free for writing when its sequence equals the write position.
+    for(unsigned int i = 0; i < slots; i++) {
+        SDL_AtomicSet(&queue->seq[i], (int)i);
+    }
+    return queue;
+
+EXIT_2:
+    free(queue->seq);
+EXIT_1:
+    free(queue);
+EXIT_0:
+    return NULL;
+}
+
+/**
+  * Destroys the queue. Items still in the queue are discarded.
+  * @param queue Queue to destroy
+  */
+void Kit_DestroyMPSCQueue(Kit_MPSCQueue *queue) {
+    if(queue == NULL) return;
+    free(queue->data);
+    free(queue->seq);
+    free(queue);
+}
+
+/**
+  * Pushes a copy of the item to the queue. May be called from any thread.
+  * @param queue Queue to push to
+  * @param item Item to copy (item_size bytes)
+  * @return 0 on success, 1 if the queue is full
+  */
+int Kit_PushMPSCQueue(Kit_MPSCQueue *queue, const void *item) {
+    assert(queue != NULL);
+    assert(item != NULL);
+    unsigned int pos = (unsigned int)SDL_AtomicGet(&queue->write_p);
+    unsigned int slot;
+    int diff;
+
+    // Claim a slot by bumping the write position. If some other producer got there first, retry.
+    while(1) {
+        slot = pos & queue->mask;
+        diff = (int)((unsigned int)SDL_AtomicGet(&queue->seq[slot]) - pos);
+        if(diff == 0) {
+            if(SDL_AtomicCAS(&queue->write_p, (int)pos, (int)(pos + 1)))
+                break;
+        } else if(diff < 0) {
+            return 1;
+        }
+        pos = (unsigned int)SDL_AtomicGet(&queue->write_p);
+    }
+
+    // Fill the slot, then publish it to the consumer.
+    memcpy(queue->data + slot * queue->item_size, item, queue->item_size);
+    SDL_AtomicSet(&queue->seq[slot], (int)(pos + 1));
+    return 0;
+}
+
+/**
+  * Pops an item from the queue. Must only be called by a single thread at a time.
+  * @param queue Queue to pop from
+  * @param item Target for the item (item_size bytes)
+  * @return 0 on success, 1 if the queue is empty
+  */
+int Kit_PopMPSCQueue(Kit_MPSCQueue *queue, void *item) {
+    assert(queue != NULL);
+    assert(item != NULL);
+    unsigned int pos = queue->read_p;
+    unsigned int slot = pos & queue->mask;
+
+    if((unsigned int)SDL_AtomicGet(&queue->seq[slot]) != pos + 1) {
+        return 1;
+    }
+    memcpy(item, queue->data + slot * queue->item_size, queue->item_size);
+    queue->read_p = pos + 1;
+
+    // Mark the slot free for the producer that wraps around to it next.
+    SDL_AtomicSet(&queue->seq[slot], (int)(pos + queue->mask + 1));
+    return 0;
+}
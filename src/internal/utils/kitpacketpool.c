@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "kitchensink/internal/utils/kitpacketpool.h"
+
+/**
+  * Creates a new packet pool. Packets are allocated lazily on first use.
+  * @param size Max. number of free packets kept for reuse
+  * @return Pool handle or NULL on failure
+  */
+Kit_PacketPool* Kit_CreatePacketPool(unsigned int size) {
+    Kit_PacketPool *pool = calloc(1, sizeof(Kit_PacketPool));
+    if(pool == NULL) {
+        return NULL;
+    }
+    pool->free_packets = Kit_CreateMPSCQueue(size, sizeof(AVPacket*));
+    if(pool->free_packets == NULL) {
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/**
+  * Destroys the pool and frees all packets in it. Packets still in use are not touched.
+  * @param pool Pool to destroy
+  */
+void Kit_DestroyPacketPool(Kit_PacketPool *pool) {
+    if(pool == NULL) return;
+    AVPacket *packet = NULL;
+    while(Kit_PopMPSCQueue(pool->free_packets, &packet) == 0) {
+        av_packet_free(&packet);
+    }
+    Kit_DestroyMPSCQueue(pool->free_packets);
+    free(pool);
+}
+
+/**
+  * Takes an empty packet from the pool, or allocates a new one if there are none left.
+  * Must only be called by a single thread at a time.
+  * @param pool Pool to take from
+  * @return Empty packet or NULL on allocation failure
+  */
+AVPacket* Kit_AcquirePacket(Kit_PacketPool *pool) {
+    assert(pool != NULL);
+    AVPacket *packet = NULL;
+    if(Kit_PopMPSCQueue(pool->free_packets, &packet) == 0) {
+        return packet;
+    }
+    packet = av_packet_alloc();
+    if(packet != NULL) {
+        SDL_AtomicAdd(&pool->allocations, 1);
+    }
+    return packet;
+}
+
+/**
+  * Unreferences the packet and returns it to the pool. May be called from any thread.
+  * If there is no pool, or the pool is full, the packet is freed instead.
+  * @param pool Pool to return to (may be NULL)
+  * @param packet Packet to release (may be NULL)
+  */
+void Kit_ReleasePacket(Kit_PacketPool *pool, AVPacket *packet) {
+    if(packet == NULL) return;
+    av_packet_unref(packet);
+    if(pool == NULL || Kit_PushMPSCQueue(pool->free_packets, &packet) != 0) {
+        av_packet_free(&packet);
+    }
+}
+
+/**
+  * Returns the number of packets the pool has allocated. Once the pool has warmed up,
+  * this should stay constant.
+  * @param pool Pool to check
+  * @return Allocation count
+  */
+unsigned int Kit_GetPacketPoolAllocations(const Kit_PacketPool *pool) {
+    if(pool == NULL) return 0;
+    return (unsigned int)SDL_AtomicGet((SDL_atomic_t*)&pool->allocations);
+}
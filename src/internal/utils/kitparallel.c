@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "kitchensink/kiterror.h"
+#include "kitchensink/internal/utils/kitparallel.h"
+#include "kitchensink/internal/utils/kitthread.h"
+
+static void _RunJobs(Kit_Parallel *parallel) {
+    int index;
+    while((index = SDL_AtomicAdd(&parallel->next, 1)) < parallel->job_count) {
+        parallel->job(parallel->userdata, index);
+    }
+}
+
+static int _ParallelThread(void *ptr) {
+    Kit_Parallel *parallel = ptr;
+
+    Kit_SetupWorkerThread();
+    while(1) {
+        SDL_SemWait(parallel->start);
+        if(SDL_AtomicGet(&parallel->quitting))
+            break;
+        _RunJobs(parallel);
+        SDL_SemPost(parallel->done);
+    }
+    return 0;
+}
+
+/**
+  * Creates helper threads for running jobs in parallel.
+  * @param thread_count Number of helper threads, not counting the calling thread
+  * @return Handle or NULL on failure
+  */
+Kit_Parallel* Kit_CreateParallel(int thread_count) {
+    assert(thread_count > 0);
+    int i = 0;
+
+    Kit_Parallel *parallel = calloc(1, sizeof(Kit_Parallel));
+    if(parallel == NULL) {
+        Kit_SetError("Unable to allocate parallel job runner");
+        goto EXIT_0;
+    }
+    parallel->thread_count = thread_count;
+
+    parallel->start = SDL_CreateSemaphore(0);
+    parallel->done = SDL_CreateSemaphore(0);
+    parallel->threads = calloc(thread_count, sizeof(SDL_Thread*));
+    if(parallel->start == NULL || parallel->done == NULL || parallel->threads == NULL) {
+        Kit_SetError("Unable to allocate parallel job runner");
+        goto EXIT_1;
+    }
+
+    for(i = 0; i < thread_count; i++) {
+        parallel->threads[i] = SDL_CreateThread(_ParallelThread, "Kit Helper Thread", parallel);
+        if(parallel->threads[i] == NULL) {
+            Kit_SetError("Unable to create helper thread: %s", SDL_GetError());
+            goto EXIT_2;
+        }
+    }
+
+    return parallel;
+
+EXIT_2:
+    SDL_AtomicSet(&parallel->quitting, 1);
+    for(int k = 0; k < i; k++) {
+        SDL_SemPost(parallel->start);
+    }
+    for(int k = 0; k < i; k++) {
+        SDL_WaitThread(parallel->threads[k], NULL);
+    }
+EXIT_1:
+    free(parallel->threads);
+    if(parallel->done != NULL)
+        SDL_DestroySemaphore(parallel->done);
+    if(parallel->start != NULL)
+        SDL_DestroySemaphore(parallel->start);
+    free(parallel);
+EXIT_0:
+    return NULL;
+}
+
+/**
+  * Stops the helper threads and frees the runner. No batch may be running.
+  * @param parallel Runner to close
+  */
+void Kit_CloseParallel(Kit_Parallel *parallel) {
+    if(parallel == NULL) return;
+    SDL_AtomicSet(&parallel->quitting, 1);
+    for(int i = 0; i < parallel->thread_count; i++) {
+        SDL_SemPost(parallel->start);
+    }
+    for(int i = 0; i < parallel->thread_count; i++) {
+        SDL_WaitThread(parallel->threads[i], NULL);
+    }
+    SDL_DestroySemaphore(parallel->done);
+    SDL_DestroySemaphore(parallel->start);
+    free(parallel->threads);
+    free(parallel);
+}
+
+/**
+  * Runs job(userdata, index) for every index in [0, job_count), and returns when all are done.
+  * @param parallel Runner to use
+  * @param job Job function
+  * @param userdata Argument for the job function
+  * @param job_count Number of jobs
+  */
+void Kit_RunParallel(Kit_Parallel *parallel, Kit_ParallelJob job, void *userdata, int job_count) {
+    assert(parallel != NULL);
+    assert(job != NULL);
+
+    // Helpers already working for somebody else means there are no idle cores to hand out
+    // either, so just do the work here instead of waiting for them.
+    if(!SDL_AtomicTryLock(&parallel->busy)) {
+        for(int i = 0; i < job_count; i++) {
+            job(userdata, i);
+        }
+        return;
+    }
+
+    // Batch setup is published to the helpers by the semaphore post.
+    parallel->job = job;
+    parallel->userdata = userdata;
+    parallel->job_count = job_count;
+    SDL_AtomicSet(&parallel->next, 0);
+    for(int i = 0; i < parallel->thread_count; i++) {
+        SDL_SemPost(parallel->start);
+    }
+    _RunJobs(parallel);
+    for(int i = 0; i < parallel->thread_count; i++) {
+        SDL_SemWait(parallel->done);
+    }
+    SDL_AtomicUnlock(&parallel->busy);
+}
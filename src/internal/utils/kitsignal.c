@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "kitchensink/internal/utils/kitsignal.h"
+
+/**
+  * Creates a new wakeup signal. A signal is used to put a thread to sleep until
+  * some other thread notifies it that there might be more work to do.
+  * @return Signal handle or NULL on failure
+  */
+Kit_Signal* Kit_CreateSignal() {
+    Kit_Signal *signal = calloc(1, sizeof(Kit_Signal));
+    if(signal == NULL) {
+        goto EXIT_0;
+    }
+    signal->lock = SDL_CreateMutex();
+    if(signal->lock == NULL) {
+        goto EXIT_1;
+    }
+    signal->cond = SDL_CreateCond();
+    if(signal->cond == NULL) {
+        goto EXIT_2;
+    }
+    return signal;
+
+EXIT_2:
+    SDL_DestroyMutex(signal->lock);
+EXIT_1:
+    free(signal);
+EXIT_0:
+    return NULL;
+}
+
+/**
+  * Destroys the given signal. Nobody may be waiting on the signal anymore.
+  * @param signal Signal to destroy
+  */
+void Kit_DestroySignal(Kit_Signal *signal) {
+    if(signal == NULL) return;
+    SDL_DestroyCond(signal->cond);
+    SDL_DestroyMutex(signal->lock);
+    free(signal);
+}
+
+/**
+  * Sets a callback that gets called every time the signal is raised. This can be used
+  * to schedule work instead of waking up a sleeping thread. Callbacks run under the signal
+  * lock, so once this returns, no call to the old callback is in progress anymore.
+  * @param signal Signal to modify
+  * @param callback Callback function, or NULL to disable
+  * @param userdata Argument for the callback function
+  */
+void Kit_SetSignalCallback(Kit_Signal *signal, Kit_SignalCallback callback, void *userdata) {
+    assert(signal != NULL);
+    if(SDL_LockMutex(signal->lock) == 0) {
+        signal->callback = callback;
+        signal->userdata = userdata;
+        SDL_UnlockMutex(signal->lock);
+    }
+}
+
+/**
+  * Raises the signal, waking up the waiting thread. If nobody is waiting, the next
+  * call to Kit_WaitSignal() will return immediately, so notifications are never lost.
+  * Raising a NULL signal does nothing.
+  * @param signal Signal to raise
+  */
+void Kit_RaiseSignal(Kit_Signal *signal) {
+    if(signal == NULL) return;
+    if(SDL_LockMutex(signal->lock) == 0) {
+        if(signal->callback != NULL) {
+            signal->callback(signal->userdata);
+        } else {
+            signal->raised = true;
+            SDL_CondSignal(signal->cond);
+        }
+        SDL_UnlockMutex(signal->lock);
+    }
+}
+
+/**
+  * Blocks until the signal is raised, then lowers it again.
+  * @param signal Signal to wait on
+  */
+void Kit_WaitSignal(Kit_Signal *signal) {
+    assert(signal != NULL);
+    if(SDL_LockMutex(signal->lock) == 0) {
+        while(!signal->raised) {
+            SDL_CondWait(signal->cond, signal->lock);
+        }
+        signal->raised = false;
+        SDL_UnlockMutex(signal->lock);
+    }
+}
+
+/**
+  * Blocks until the signal is raised or the timeout passes, and lowers the signal if it was raised.
+  * May return early without the signal being raised.
+  * @param signal Signal to wait on
+  * @param timeout_ms Longest time to wait, in milliseconds
+  * @return True if the signal was raised
+  */
+bool Kit_WaitSignalTimeout(Kit_Signal *signal, Uint32 timeout_ms) {
+    assert(signal != NULL);
+    bool raised = false;
+    if(SDL_LockMutex(signal->lock) == 0) {
+        if(!signal->raised) {
+            SDL_CondWaitTimeout(signal->cond, signal->lock, timeout_ms);
+        }
+        raised = signal->raised;
+        signal->raised = false;
+        SDL_UnlockMutex(signal->lock);
+    }
+    return raised;
+}
+
+/**
+  * Checks if the signal has been raised, and lowers it if it has. Never blocks.
+  * @param signal Signal to check
+  * @return True if the signal was raised
+  */
+bool Kit_PollSignal(Kit_Signal *signal) {
+    assert(signal != NULL);
+    bool raised = false;
+    if(SDL_LockMutex(signal->lock) == 0) {
+        raised = signal->raised;
+        signal->raised = false;
+        SDL_UnlockMutex(signal->lock);
+    }
+    return raised;
+}
@@ -0,0 +1,85 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+#include <stdlib.h>
+
+#include <SDL_thread.h>
+
+#include "kitchensink/kitlib.h"
+#include "kitchensink/internal/kitlibstate.h"
+#include "kitchensink/internal/utils/kitthread.h"
+
+static int _SetAffinity(unsigned int mask) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(unsigned int i = 0; i < sizeof(mask) * 8; i++) {
+        if(mask & (1u << i)) {
+            CPU_SET(i, &set);
+        }
+    }
+    return sched_setaffinity(0, sizeof(cpu_set_t), &set);
+#else
+    return -1;
+#endif
+}
+
+/**
+  * Applies the thread priority and CPU affinity hints to the calling thread.
+  * Called by internal worker threads when they start.
+  */
+void Kit_SetupWorkerThread() {
+    const Kit_LibraryState *state = Kit_GetLibraryState();
+    switch(state->thread_priority) {
+        case KIT_THREAD_PRIORITY_LOW:
+            SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+            break;
+        case KIT_THREAD_PRIORITY_NORMAL:
+            SDL_SetThreadPriority(SDL_THREAD_PRIORITY_NORMAL);
+            break;
+        case KIT_THREAD_PRIORITY_HIGH:
+            SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+            break;
+        default:
+            break;
+    }
+    if(state->thread_affinity != 0) {
+        _SetAffinity(state->thread_affinity);
+    }
+}
+
+/**
+  * Temporarily applies the CPU affinity hint to the calling thread. Threads created
+  * meanwhile (eg. ffmpeg codec threads) inherit the affinity.
+  * @return Saved affinity for Kit_PopThreadAffinity(), or NULL if nothing was changed
+  */
+void* Kit_PushThreadAffinity() {
+#ifdef __linux__
+    const Kit_LibraryState *state = Kit_GetLibraryState();
+    if(state->thread_affinity == 0)
+        return NULL;
+    cpu_set_t *saved = malloc(sizeof(cpu_set_t));
+    if(saved == NULL)
+        return NULL;
+    if(sched_getaffinity(0, sizeof(cpu_set_t), saved) != 0 || _SetAffinity(state->thread_affinity) != 0) {
+        free(saved);
+        return NULL;
+    }
+    return saved;
+#else
+    return NULL;
+#endif
+}
+
+/**
+  * Restores the CPU affinity saved by Kit_PushThreadAffinity().
+  * @param saved Saved affinity (may be NULL)
+  */
+void Kit_PopThreadAffinity(void *saved) {
+    if(saved == NULL) return;
+#ifdef __linux__
+    sched_setaffinity(0, sizeof(cpu_set_t), saved);
+#endif
+    free(saved);
+}
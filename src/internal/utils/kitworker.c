@@ -0,0 +1,405 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include <SDL_timer.h>
+
+#include "kitchensink/kiterror.h"
+#include "kitchensink/internal/utils/kitworker.h"
+#include "kitchensink/internal/utils/kitthread.h"
+
+static void _PushWorker(Kit_WorkerPool *pool, Kit_Worker *worker) {
+    // Workers queued from a pool thread go to that threads own queue, others are spread evenly.
+    Kit_WorkerQueue *queue = SDL_TLSGet(pool->queue_id);
+    if(queue == NULL) {
+        unsigned int next = (unsigned int)SDL_AtomicAdd(&pool->next_queue, 1);
+        queue = &pool->queues[next % pool->thread_count];
+    }
+
+    if(SDL_LockMutex(queue->lock) == 0) {
+        worker->next = NULL;
+        if(queue->tail != NULL) {
+            queue->tail->next = worker;
+        } else {
+            queue->head = worker;
+        }
+        queue->tail = worker;
+        SDL_UnlockMutex(queue->lock);
+    }
+    SDL_SemPost(pool->pending);
+}
+
+static Kit_Worker* _PopWorker(Kit_WorkerQueue *queue) {
+    Kit_Worker *worker = NULL;
+    if(SDL_LockMutex(queue->lock) == 0) {
+        worker = queue->head;
+        if(worker != NULL) {
+            queue->head = worker->next;
+            if(queue->head == NULL) {
+                queue->tail = NULL;
+            }
+            worker->next = NULL;
+        }
+        SDL_UnlockMutex(queue->lock);
+    }
+    return worker;
+}
+
+// Runs from the signal callback, under the signal lock. Kit_CloseWorker() removes the callback
+// first, so no submit can be in progress once it starts waiting for the worker to go idle.
+static void _SubmitWorker(void *ptr) {
+    Kit_Worker *worker = ptr;
+    int state;
+
+    if(SDL_AtomicGet(&worker->closing))
+        return;
+
+    // Queue the worker if it is idle. If it is already running, just tell the running thread
+    // to queue it again after it is done, so that nothing gets lost.
+    while(1) {
+        state = SDL_AtomicGet(&worker->state);
+        switch(state) {
+            case KIT_WORKER_IDLE:
+                if(SDL_AtomicCAS(&worker->state, KIT_WORKER_IDLE, KIT_WORKER_QUEUED)) {
+                    _PushWorker(worker->pool, worker);
+                    return;
+                }
+                break;
+            case KIT_WORKER_RUNNING:
+                if(SDL_AtomicCAS(&worker->state, KIT_WORKER_RUNNING, KIT_WORKER_RERUN)) {
+                    return;
+                }
+                break;
+            default:
+                return;
+        }
+    }
+}
+
+static int _RunStep(Kit_Worker *worker) {
+    // Run a single step, and keep track of the longest time the lock has been held.
+    int ret = 0;
+    int hold;
+    int max_hold;
+    Uint64 start;
+    if(SDL_LockMutex(worker->lock) == 0) {
+        start = SDL_GetPerformanceCounter();
+        ret = worker->step(worker->userdata);
+        hold = (int)((SDL_GetPerformanceCounter() - start) * 1000000 / SDL_GetPerformanceFrequency());
+        SDL_UnlockMutex(worker->lock);
+
+        max_hold = SDL_AtomicGet(&worker->max_hold_us);
+        while(hold > max_hold && !SDL_AtomicCAS(&worker->max_hold_us, max_hold, hold)) {
+            max_hold = SDL_AtomicGet(&worker->max_hold_us);
+        }
+    }
+    return ret;
+}
+
+static bool _SetPoolWorkerIdle(Kit_Worker *worker) {
+    // Going idle happens under the pool idle lock, so that Kit_CloseWorker() can not miss it.
+    // Once the lock is released, the worker may be freed; do not touch it after that.
+    Kit_WorkerPool *pool = worker->pool;
+    bool idle = false;
+    if(SDL_LockMutex(pool->idle_lock) == 0) {
+        idle = SDL_AtomicCAS(&worker->state, KIT_WORKER_RUNNING, KIT_WORKER_IDLE);
+        if(idle && SDL_AtomicGet(&worker->closing)) {
+            SDL_CondBroadcast(pool->idle_cond);
+        }
+        SDL_UnlockMutex(pool->idle_lock);
+    }
+    return idle;
+}
+
+static void _RunPoolWorker(Kit_Worker *worker) {
+    int ret = 0;
+
+    SDL_AtomicSet(&worker->state, KIT_WORKER_RUNNING);
+    if(SDL_AtomicGet(&worker->closing)) {
+        _SetPoolWorkerIdle(worker);
+        return;
+    }
+    ret = _RunStep(worker);
+
+    // If there is nothing more to do, and nobody signaled us while running, we are done.
+    // Otherwise go to the back of the queue so that other workers get their turn, too. Pool
+    // threads have no timers, so waiting workers are requeued as well.
+    if(ret == KIT_WORKER_DONE && _SetPoolWorkerIdle(worker))
+        return;
+    SDL_AtomicSet(&worker->state, KIT_WORKER_QUEUED);
+    _PushWorker(worker->pool, worker);
+}
+
+static int _PoolThread(void *ptr) {
+    Kit_WorkerQueue *own = ptr;
+    Kit_WorkerPool *pool = own->pool;
+    Kit_Worker *worker = NULL;
+
+    Kit_SetupWorkerThread();
+    SDL_TLSSet(pool->queue_id, own, NULL);
+    while(1) {
+        SDL_SemWait(pool->pending);
+        if(SDL_AtomicGet(&pool->quitting))
+            break;
+
+        // Semaphore guarantees there is a worker queued for us somewhere. Look at our own
+        // queue first, and if it is empty, steal from the other threads.
+        worker = _PopWorker(own);
+        for(int i = 1; worker == NULL; i++) {
+            worker = _PopWorker(&pool->queues[(own->index + i) % pool->thread_count]);
+        }
+        _RunPoolWorker(worker);
+    }
+
+    return 0;
+}
+
+static int _WorkerThread(void *ptr) {
+    Kit_Worker *worker = ptr;
+    int ret = 0;
+
+    Kit_SetupWorkerThread();
+    while(!SDL_AtomicGet(&worker->closing)) {
+        ret = _RunStep(worker);
+
+        // Nothing to do right now, so sleep until somebody tells us otherwise. If the step is
+        // waiting on something that might never signal us, only sleep for a short while.
+        if(ret == KIT_WORKER_DONE) {
+            Kit_WaitSignal(worker->signal);
+        } else if(ret == KIT_WORKER_WAIT) {
+            Kit_WaitSignalTimeout(worker->signal, KIT_WORKER_WAIT_MS);
+        }
+    }
+
+    return 0;
+}
+
+static Kit_Worker* _AllocWorker(Kit_WorkerStep step, void *userdata) {
+    assert(step != NULL);
+
+    Kit_Worker *worker = calloc(1, sizeof(Kit_Worker));
+    if(worker == NULL) {
+        Kit_SetError("Unable to allocate worker");
+        goto EXIT_0;
+    }
+    worker->step = step;
+    worker->userdata = userdata;
+
+    worker->lock = SDL_CreateMutex();
+    if(worker->lock == NULL) {
+        Kit_SetError("Unable to create worker lock: %s", SDL_GetError());
+        goto EXIT_1;
+    }
+
+    worker->signal = Kit_CreateSignal();
+    if(worker->signal == NULL) {
+        Kit_SetError("Unable to create worker signal: %s", SDL_GetError());
+        goto EXIT_2;
+    }
+
+    return worker;
+
+EXIT_2:
+    SDL_DestroyMutex(worker->lock);
+EXIT_1:
+    free(worker);
+EXIT_0:
+    return NULL;
+}
+
+static void _FreeWorker(Kit_Worker *worker) {
+    Kit_DestroySignal(worker->signal);
+    SDL_DestroyMutex(worker->lock);
+    free(worker);
+}
+
+Kit_Worker* Kit_CreateWorker(Kit_WorkerPool *pool, const char *name, Kit_WorkerStep step, void *userdata) {
+    assert(name != NULL);
+
+    Kit_Worker *worker = _AllocWorker(step, userdata);
+    if(worker == NULL) {
+        return NULL;
+    }
+
+    // With a pool, raising the signal just queues the worker. Run it once to get it started,
+    // just like the dedicated thread would.
+    if(pool != NULL) {
+        worker->pool = pool;
+        SDL_AtomicAdd(&pool->users, 1);
+        Kit_SetSignalCallback(worker->signal, _SubmitWorker, worker);
+        _SubmitWorker(worker);
+        return worker;
+    }
+
+    worker->thread = SDL_CreateThread(_WorkerThread, name, worker);
+    if(worker->thread == NULL) {
+        Kit_SetError("Unable to create worker thread: %s", SDL_GetError());
+        _FreeWorker(worker);
+        return NULL;
+    }
+
+    return worker;
+}
+
+Kit_Worker* Kit_CreateManualWorker(Kit_WorkerStep step, void *userdata) {
+    Kit_Worker *worker = _AllocWorker(step, userdata);
+    if(worker == NULL) {
+        return NULL;
+    }
+
+    // Nothing runs this worker on its own; see Kit_RunWorker(). Raise the signal so that
+    // the first call gets it started.
+    Kit_RaiseSignal(worker->signal);
+    return worker;
+}
+
+int Kit_RunWorker(Kit_Worker *worker) {
+    int ret = 0;
+    if(worker == NULL || worker->thread != NULL || worker->pool != NULL)
+        return 0;
+    if(!Kit_PollSignal(worker->signal))
+        return 0;
+    ret = _RunStep(worker);
+
+    // Step wants to be run again (or soon); make sure the next call does that.
+    if(ret != KIT_WORKER_DONE) {
+        Kit_RaiseSignal(worker->signal);
+    }
+    return 1;
+}
+
+void Kit_CloseWorker(Kit_Worker *worker) {
+    if(worker == NULL) return;
+    SDL_AtomicSet(&worker->closing, 1);
+    if(worker->pool != NULL) {
+        // After the callback is gone, nobody can queue the worker anymore. Pool threads drop
+        // closing workers instead of running them, so this does not take long.
+        Kit_SetSignalCallback(worker->signal, NULL, NULL);
+        if(SDL_LockMutex(worker->pool->idle_lock) == 0) {
+            while(SDL_AtomicGet(&worker->state) != KIT_WORKER_IDLE) {
+                SDL_CondWait(worker->pool->idle_cond, worker->pool->idle_lock);
+            }
+            SDL_UnlockMutex(worker->pool->idle_lock);
+        }
+        SDL_AtomicAdd(&worker->pool->users, -1);
+    } else if(worker->thread != NULL) {
+        Kit_RaiseSignal(worker->signal);
+        SDL_WaitThread(worker->thread, NULL);
+    }
+    _FreeWorker(worker);
+}
+
+void Kit_WakeWorker(Kit_Worker *worker) {
+    if(worker == NULL) return;
+    Kit_RaiseSignal(worker->signal);
+}
+
+int Kit_LockWorker(Kit_Worker *worker) {
+    assert(worker != NULL);
+    return SDL_LockMutex(worker->lock);
+}
+
+void Kit_UnlockWorker(Kit_Worker *worker) {
+    assert(worker != NULL);
+    SDL_UnlockMutex(worker->lock);
+}
+
+int Kit_GetWorkerMaxHoldTime(Kit_Worker *worker) {
+    if(worker == NULL) return 0;
+    return SDL_AtomicGet(&worker->max_hold_us);
+}
+
+Kit_WorkerPool* Kit_CreateWorkerPool(int thread_count) {
+    assert(thread_count > 0);
+    int i = 0;
+
+    Kit_WorkerPool *pool = calloc(1, sizeof(Kit_WorkerPool));
+    if(pool == NULL) {
+        Kit_SetError("Unable to allocate worker pool");
+        goto EXIT_0;
+    }
+    pool->thread_count = thread_count;
+    pool->queue_id = SDL_TLSCreate();
+
+    pool->pending = SDL_CreateSemaphore(0);
+    if(pool->pending == NULL) {
+        Kit_SetError("Unable to create worker pool semaphore: %s", SDL_GetError());
+        goto EXIT_1;
+    }
+    pool->idle_lock = SDL_CreateMutex();
+    pool->idle_cond = SDL_CreateCond();
+    if(pool->idle_lock == NULL || pool->idle_cond == NULL) {
+        Kit_SetError("Unable to create worker pool idle lock: %s", SDL_GetError());
+        goto EXIT_2;
+    }
+
+    pool->queues = calloc(thread_count, sizeof(Kit_WorkerQueue));
+    pool->threads = calloc(thread_count, sizeof(SDL_Thread*));
+    if(pool->queues == NULL || pool->threads == NULL) {
+        Kit_SetError("Unable to allocate worker pool queues");
+        goto EXIT_2;
+    }
+    for(i = 0; i < thread_count; i++) {
+        pool->queues[i].pool = pool;
+        pool->queues[i].index = i;
+        pool->queues[i].lock = SDL_CreateMutex();
+        if(pool->queues[i].lock == NULL) {
+            Kit_SetError("Unable to create worker pool queue lock: %s", SDL_GetError());
+            goto EXIT_3;
+        }
+    }
+
+    for(i = 0; i < thread_count; i++) {
+        pool->threads[i] = SDL_CreateThread(_PoolThread, "Kit Worker Pool Thread", &pool->queues[i]);
+        if(pool->threads[i] == NULL) {
+            Kit_SetError("Unable to create worker pool thread: %s", SDL_GetError());
+            goto EXIT_4;
+        }
+    }
+
+    return pool;
+
+EXIT_4:
+    SDL_AtomicSet(&pool->quitting, 1);
+    for(int k = 0; k < i; k++) {
+        SDL_SemPost(pool->pending);
+    }
+    for(int k = 0; k < i; k++) {
+        SDL_WaitThread(pool->threads[k], NULL);
+    }
+    i = thread_count;
+EXIT_3:
+    for(int k = 0; k < i; k++) {
+        SDL_DestroyMutex(pool->queues[k].lock);
+    }
+EXIT_2:
+    free(pool->threads);
+    free(pool->queues);
+    if(pool->idle_cond != NULL) SDL_DestroyCond(pool->idle_cond);
+    if(pool->idle_lock != NULL) SDL_DestroyMutex(pool->idle_lock);
+    SDL_DestroySemaphore(pool->pending);
+EXIT_1:
+    free(pool);
+EXIT_0:
+    return NULL;
+}
+
+void Kit_CloseWorkerPool(Kit_WorkerPool *pool) {
+    if(pool == NULL) return;
+
+    // All workers must be closed before this, so nothing is running anymore.
+    assert(SDL_AtomicGet(&pool->users) == 0);
+    SDL_AtomicSet(&pool->quitting, 1);
+    for(int i = 0; i < pool->thread_count; i++) {
+        SDL_SemPost(pool->pending);
+    }
+    for(int i = 0; i < pool->thread_count; i++) {
+        SDL_WaitThread(pool->threads[i], NULL);
+        SDL_DestroyMutex(pool->queues[i].lock);
+    }
+    SDL_DestroyCond(pool->idle_cond);
+    SDL_DestroyMutex(pool->idle_lock);
+    SDL_DestroySemaphore(pool->pending);
+    free(pool->threads);
+    free(pool->queues);
+    free(pool);
+}
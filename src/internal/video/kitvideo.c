@@ -1,16 +1,34 @@
 #include <assert.h>
+#include <limits.h>
+
+#include <SDL_timer.h>
+#include <SDL_version.h>
 
 #include <libavformat/avformat.h>
+#include <libavutil/buffer.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 #include <libswscale/swscale.h>
 
 #include "kitchensink/kiterror.h"
 #include "kitchensink/internal/kitlibstate.h"
 #include "kitchensink/internal/kitdecoder.h"
 #include "kitchensink/internal/utils/kithelpers.h"
+#include "kitchensink/internal/utils/kitparallel.h"
 #include "kitchensink/internal/video/kitvideo.h"
+#include "kitchensink/internal/video/kityuv.h"
 
 #define KIT_VIDEO_SYNC_THRESHOLD 0.02
+#define KIT_VIDEO_SLICE_ALIGN 16
+#define KIT_VIDEO_SKIP_RAISE 0.1  // Lateness (seconds) of the next frame at which decoding shortcuts increase
+#define KIT_VIDEO_SKIP_LOWER 0.0  // Lateness (seconds) of the next frame at which decoding shortcuts decrease
+#define KIT_VIDEO_SKIP_HOLD 0.5   // Minimum time (seconds) between shortcut level changes
+
+#if LIBAVUTIL_VERSION_MAJOR < 57
+typedef int Kit_BufferSize;
+#else
+typedef size_t Kit_BufferSize;
+#endif
 
 enum AVPixelFormat supported_list[] = {
     AV_PIX_FMT_YUV420P,
@@ -29,14 +47,76 @@ enum AVPixelFormat supported_list[] = {
     AV_PIX_FMT_NONE
 };
 
+// Decoding shortcuts taken when playback falls behind, from none to the most aggressive.
+typedef struct Kit_VideoSkipLevel {
+    enum AVDiscard skip_frame;
+    enum AVDiscard skip_loop_filter;
+} Kit_VideoSkipLevel;
+
+static const Kit_VideoSkipLevel skip_levels[] = {
+    {AVDISCARD_DEFAULT, AVDISCARD_DEFAULT},
+    {AVDISCARD_DEFAULT, AVDISCARD_NONREF},
+    {AVDISCARD_NONREF, AVDISCARD_BIDIR},
+    {AVDISCARD_BIDIR, AVDISCARD_ALL},
+    {AVDISCARD_NONKEY, AVDISCARD_ALL},
+};
+
+// Shared by a frame buffer pool and all buffers allocated from it; freed along with the pool.
+typedef struct Kit_FramePoolInfo {
+    Kit_MemoryCounter *memory;    ///< Counter the buffers are accounted to
+    Kit_BufferSize size;          ///< Size of a single buffer
+} Kit_FramePoolInfo;
+
+typedef struct Kit_FramePool {
+    AVBufferPool *pool;           ///< Recycles frame buffers of the current size and format
+    int width;                    ///< Frame width the pool buffers are sized for
+    int height;                   ///< Frame height the pool buffers are sized for
+    enum AVPixelFormat fmt;       ///< Pixel format the pool buffers are sized for
+} Kit_FramePool;
+
 typedef struct Kit_VideoDecoder {
     struct SwsContext *sws;
     AVFrame *scratch_frame;
+    Kit_FramePool out_pool;       ///< Output frames converted on the decoder thread
+    Kit_FramePool lease_pool;     ///< Leased frames converted on the presenting thread
+    double frame_duration;        ///< Nominal frame duration in seconds, for output buffer limits (0 if unknown)
+    int sws_flags;                ///< Scaling filter for all conversions
+    SDL_atomic_t output_size;     ///< Requested output size as (w << 16) | h, or 0 for source size
+    int direct_upload;            ///< Frames are passed through as-is and converted when uploaded
+    struct SwsContext *present_sws;  ///< Converter for uploads; only used from the presenting thread
+    AVFrame *upload_frame;        ///< Converted frame for textures that cannot be locked
+    size_t upload_bytes;          ///< Memory held by upload_frame
+    Kit_Parallel *slicer;         ///< Library helper threads for sliced conversion (NULL if not in use)
+    struct SwsContext **slice_sws;  ///< Converter for each slice
+    int slice_count;              ///< Number of slices, helpers plus the decoder thread
+    SDL_atomic_t convert_us;      ///< Moving average of the frame conversion time (microseconds)
+    SDL_atomic_t lateness_ms;     ///< Lateness of the next frame when last presented (negative if early)
+    int skip_level;               ///< Current index to skip_levels
+    double skip_changed;          ///< System time of the last skip level change
+    bool has_decoded;             ///< A frame has been written since the last flush or resume
+    enum AVDiscard base_skip_loop_filter;  ///< Loop filter skipping set up with the codec; skip levels never go below
+    int decode_width;             ///< Decoded frame width (smaller than the stream with low resolution decoding)
+    int decode_height;            ///< Decoded frame height (smaller than the stream with low resolution decoding)
 } Kit_VideoDecoder;
 
+// Shared by the jobs of a single sliced conversion.
+typedef struct Kit_ConvertSlices {
+    Kit_VideoDecoder *video_dec;
+    const AVFrame *src;
+    AVFrame *dst;
+    enum AVPixelFormat in_fmt;
+    enum AVPixelFormat out_fmt;
+    int slice_h;                  ///< Rows per slice (last one may have fewer)
+    int src_shift;                ///< Source chroma plane vertical subsampling
+    int dst_shift;                ///< Target chroma plane vertical subsampling
+    const Kit_YUVConverter *yuv;  ///< Fast converter to use instead of swscale (NULL if none)
+} Kit_ConvertSlices;
+
 typedef struct Kit_VideoPacket {
     double pts;
     AVFrame *frame;
+    size_t borrowed_bytes;      ///< Size of decoder owned buffers held by a passed-through frame
+    Kit_MemoryCounter *memory;  ///< Counter the borrowed buffers are accounted to
 } Kit_VideoPacket;
 
 
@@ -91,7 +171,8 @@ static struct SwsContext* _GetSwsContext(
     int dst_w,
     int dst_h,
     enum AVPixelFormat in_fmt,
-    enum AVPixelFormat out_fmt
+    enum AVPixelFormat out_fmt,
+    int flags
 ) {
     struct SwsContext* new_context = sws_getCachedContext(
         old_context,
@@ -101,7 +182,7 @@ static struct SwsContext* _GetSwsContext(
         dst_w,
         dst_h,
         out_fmt,
-        SWS_BILINEAR,
+        flags,
         NULL,
         NULL,
         NULL
@@ -112,66 +193,551 @@ static struct SwsContext* _GetSwsContext(
     return new_context;
 }
 
+static int _FindSwsFlags(unsigned int quality) {
+    switch(quality) {
+        case KIT_SCALE_FAST_BILINEAR: return SWS_FAST_BILINEAR;
+        case KIT_SCALE_POINT: return SWS_POINT;
+        case KIT_SCALE_BICUBIC: return SWS_BICUBIC;
+        default:
+            return SWS_BILINEAR;
+    }
+}
+
+static void _GetOutputSize(Kit_VideoDecoder *video_dec, int src_w, int src_h, int *w, int *h) {
+    int size = SDL_AtomicGet(&video_dec->output_size);
+    *w = (size >> 16) & 0xFFFF;
+    *h = size & 0xFFFF;
+    if(*w == 0 || *h == 0) {
+        *w = src_w;
+        *h = src_h;
+    }
+}
+
+static void _FreeFrameBuffer(void *opaque, uint8_t *data) {
+    const Kit_FramePoolInfo *info = opaque;
+    Kit_RemoveMemory(info->memory, KIT_MEMORY_VIDEO, (size_t)info->size);
+    av_free(data);
+}
+
+static AVBufferRef* _AllocFrameBuffer(void *opaque, Kit_BufferSize size) {
+    Kit_FramePoolInfo *info = opaque;
+    AVBufferRef *ref = NULL;
+    uint8_t *data = av_malloc(size);
+    if(data == NULL) {
+        return NULL;
+    }
+    ref = av_buffer_create(data, size, _FreeFrameBuffer, info, 0);
+    if(ref == NULL) {
+        av_free(data);
+        return NULL;
+    }
+    Kit_AddMemory(info->memory, KIT_MEMORY_VIDEO, (size_t)size);
+    return ref;
+}
+
+static void _FreeFramePool(void *opaque) {
+    free(opaque);
+}
+
+static AVFrame* _AllocPoolFrame(Kit_MemoryCounter *memory, Kit_FramePool *pool, int w, int h, enum AVPixelFormat fmt) {
+    // Buffers are only reallocated when the stream resolution or format changes. Buffers of the
+    // old pool that are still in use keep it alive until they are released.
+    if(pool->pool == NULL || pool->width != w || pool->height != h || pool->fmt != fmt) {
+        av_buffer_pool_uninit(&pool->pool);
+        Kit_FramePoolInfo *info = calloc(1, sizeof(Kit_FramePoolInfo));
+        if(info == NULL) {
+            return NULL;
+        }
+        info->memory = memory;
+        info->size = av_image_get_buffer_size(fmt, w, h, 1);
+        pool->pool = av_buffer_pool_init2(info->size, info, _AllocFrameBuffer, _FreeFramePool);
+        if(pool->pool == NULL) {
+            free(info);
+            return NULL;
+        }
+        pool->width = w;
+        pool->height = h;
+        pool->fmt = fmt;
+    }
+
+    AVFrame *frame = av_frame_alloc();
+    if(frame == NULL) {
+        return NULL;
+    }
+    frame->buf[0] = av_buffer_pool_get(pool->pool);
+    if(frame->buf[0] == NULL) {
+        av_frame_free(&frame);
+        return NULL;
+    }
+    av_image_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data, fmt, w, h, 1);
+    frame->width = w;
+    frame->height = h;
+    frame->format = fmt;
+    return frame;
+}
+
 static void free_out_video_packet_cb(void *packet) {
+    // Frame buffer goes back to the pool (ours or the decoders) when the frame is unreferenced.
     Kit_VideoPacket *p = packet;
-    av_freep(&p->frame->data[0]);
+    if(p->borrowed_bytes > 0) {
+        Kit_RemoveMemory(p->memory, KIT_MEMORY_VIDEO, p->borrowed_bytes);
+    }
     av_frame_free(&p->frame);
     free(p);
 }
 
-static void dec_read_video(const Kit_Decoder *dec) {
+static size_t _GetFrameBytes(const AVFrame *frame) {
+    size_t bytes = 0;
+    for(int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i] != NULL; i++) {
+        bytes += frame->buf[i]->size;
+    }
+    return bytes;
+}
+
+static int _CreateSlicer(Kit_VideoDecoder *video_dec) {
+    // Helper threads belong to the library and are shared by all decoders; each decoder only
+    // keeps a converter for each of its slices.
+    Kit_Parallel *slicer = NULL;
+    if(video_dec->slicer != NULL)
+        return 0;
+    slicer = Kit_GetLibraryConvertRunner();
+    if(slicer == NULL)
+        return 0;
+    video_dec->slice_sws = calloc(slicer->thread_count + 1, sizeof(struct SwsContext*));
+    if(video_dec->slice_sws == NULL) {
+        return 1;
+    }
+    video_dec->slicer = slicer;
+    video_dec->slice_count = slicer->thread_count + 1;
+    return 0;
+}
+
+static void _FreeSlicer(Kit_VideoDecoder *video_dec) {
+    if(video_dec->slicer == NULL)
+        return;
+    for(int i = 0; i < video_dec->slice_count; i++) {
+        if(video_dec->slice_sws[i] != NULL) {
+            sws_freeContext(video_dec->slice_sws[i]);
+        }
+    }
+    free(video_dec->slice_sws);
+    video_dec->slicer = NULL;
+    video_dec->slice_sws = NULL;
+    video_dec->slice_count = 0;
+}
+
+static void _ConvertSlice(void *userdata, int index) {
+    Kit_ConvertSlices *slices = userdata;
+    Kit_VideoDecoder *video_dec = slices->video_dec;
+    const AVFrame *src = slices->src;
+    AVFrame *dst = slices->dst;
+    const uint8_t *src_data[4];
+    uint8_t *dst_data[4];
+    int y = index * slices->slice_h;
+    int h = src->height - y;
+    if(h > slices->slice_h) {
+        h = slices->slice_h;
+    }
+    if(h <= 0) {
+        return;
+    }
+    if(slices->yuv != NULL) {
+        Kit_RunYUVConverter(slices->yuv, src, dst->data[0], dst->linesize[0], y, h);
+        return;
+    }
+
+    // Each slice is converted as a separate image, starting at its own row. Chroma planes
+    // (1 and 2) are subsampled, luma and alpha are not.
+    for(int p = 0; p < 4; p++) {
+        int src_row = (p == 1 || p == 2) ? y >> slices->src_shift : y;
+        int dst_row = (p == 1 || p == 2) ? y >> slices->dst_shift : y;
+        src_data[p] = src->data[p] ? src->data[p] + src_row * src->linesize[p] : NULL;
+        dst_data[p] = dst->data[p] ? dst->data[p] + dst_row * dst->linesize[p] : NULL;
+    }
+    video_dec->slice_sws[index] = _GetSwsContext(
+        video_dec->slice_sws[index],
+        src->width,
+        h,
+        dst->width,
+        h,
+        slices->in_fmt,
+        slices->out_fmt,
+        video_dec->sws_flags);
+    if(video_dec->slice_sws[index] == NULL) {
+        return;
+    }
+    sws_scale(
+        video_dec->slice_sws[index],
+        (const unsigned char * const *)src_data,
+        src->linesize,
+        0,
+        h,
+        dst_data,
+        dst->linesize);
+}
+
+static bool _ConvertSliced(Kit_VideoDecoder *video_dec, const AVFrame *src, AVFrame *dst,
+                           enum AVPixelFormat in_fmt, enum AVPixelFormat out_fmt,
+                           const Kit_YUVConverter *yuv) {
+    // Slices only work if rows map 1:1, and there is no palette plane to offset by mistake.
+    const AVPixFmtDescriptor *in_desc = av_pix_fmt_desc_get(in_fmt);
+    const AVPixFmtDescriptor *out_desc = av_pix_fmt_desc_get(out_fmt);
+    Kit_ConvertSlices slices;
+    if(video_dec->slicer == NULL || src->height != dst->height || in_desc == NULL || out_desc == NULL)
+        return false;
+    if((in_desc->flags | out_desc->flags) & AV_PIX_FMT_FLAG_PAL)
+        return false;
+
+    // Slice heights are aligned so that chroma rows never straddle two slices.
+    slices.video_dec = video_dec;
+    slices.src = src;
+    slices.dst = dst;
+    slices.in_fmt = in_fmt;
+    slices.out_fmt = out_fmt;
+    slices.src_shift = in_desc->log2_chroma_h;
+    slices.dst_shift = out_desc->log2_chroma_h;
+    slices.yuv = yuv;
+    slices.slice_h = (src->height + video_dec->slice_count - 1) / video_dec->slice_count;
+    slices.slice_h = (slices.slice_h + KIT_VIDEO_SLICE_ALIGN - 1) & ~(KIT_VIDEO_SLICE_ALIGN - 1);
+    Kit_RunParallel(video_dec->slicer, _ConvertSlice, &slices, video_dec->slice_count);
+    return true;
+}
+
+static AVFrame* _ConvertFrame(Kit_Decoder *dec, Kit_VideoDecoder *video_dec, int out_w, int out_h) {
+    const AVFrame *src = video_dec->scratch_frame;
+    Kit_YUVConverter yuv_conv;
+    const Kit_YUVConverter *yuv = NULL;
+    AVFrame *out_frame = _AllocPoolFrame(
+        dec->memory,
+        &video_dec->out_pool,
+        out_w,
+        out_h,
+        _FindAVPixelFormat(dec->output.format));
+    if(out_frame == NULL) {
+        return NULL;
+    }
+
+    // Common 4:2:0 to RGBA/BGRA conversions without scaling skip swscale entirely.
+    if(out_w == src->width && out_h == src->height
+            && Kit_InitYUVConverter(&yuv_conv, src, _FindAVPixelFormat(dec->output.format))) {
+        yuv = &yuv_conv;
+    }
+
+    // Convert in slices on helper threads if possible. Slices can not be scaled vertically.
+    // Otherwise scale from source format and size to target format and size in one go.
+    if(_ConvertSliced(video_dec, src, out_frame, dec->codec_ctx->pix_fmt, _FindAVPixelFormat(dec->output.format), yuv)) {
+        // Converted by the slice jobs.
+    } else if(yuv != NULL) {
+        Kit_RunYUVConverter(yuv, src, out_frame->data[0], out_frame->linesize[0], 0, src->height);
+    } else {
+        video_dec->sws = _GetSwsContext(
+            video_dec->sws,
+            video_dec->scratch_frame->width,
+            video_dec->scratch_frame->height,
+            out_w,
+            out_h,
+            dec->codec_ctx->pix_fmt,
+            _FindAVPixelFormat(dec->output.format),
+            video_dec->sws_flags);
+        sws_scale(
+            video_dec->sws,
+            (const unsigned char * const *)video_dec->scratch_frame->data,
+            video_dec->scratch_frame->linesize,
+            0,
+            video_dec->scratch_frame->height,
+            out_frame->data,
+            out_frame->linesize);
+    }
+
+    // Copy required props to safety
+    out_frame->sample_aspect_ratio = video_dec->scratch_frame->sample_aspect_ratio;
+    return out_frame;
+}
+
+static int _LockTexturePlanes(SDL_Texture *texture, unsigned int format, int tex_h, uint8_t *data[4], int linesize[4]) {
+    void *pixels = NULL;
+    int pitch = 0;
+
+    // Planar textures must be locked whole; the chroma planes follow the luma plane.
+    if(SDL_LockTexture(texture, NULL, &pixels, &pitch) < 0) {
+        return 1;
+    }
+    memset(data, 0, sizeof(uint8_t*) * 4);
+    memset(linesize, 0, sizeof(int) * 4);
+    data[0] = pixels;
+    linesize[0] = pitch;
+    switch(format) {
+        case SDL_PIXELFORMAT_YV12:
+            // Y, then V, then U. Ours are in Y, U, V order.
+            data[2] = data[0] + pitch * tex_h;
+            data[1] = data[2] + ((pitch + 1) / 2) * ((tex_h + 1) / 2);
+            linesize[1] = linesize[2] = (pitch + 1) / 2;
+            break;
+        case SDL_PIXELFORMAT_NV12:
+        case SDL_PIXELFORMAT_NV21:
+            data[1] = data[0] + pitch * tex_h;
+            linesize[1] = pitch;
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+static int _ConvertPresentFrame(Kit_VideoDecoder *video_dec, const AVFrame *src, enum AVPixelFormat out_fmt,
+                                uint8_t *const data[4], const int linesize[4]) {
+    // Passed-through 4:2:0 frames going to RGBA/BGRA skip swscale, same as on the decoder thread.
+    Kit_YUVConverter yuv;
+    if(Kit_InitYUVConverter(&yuv, src, out_fmt)) {
+        Kit_RunYUVConverter(&yuv, src, data[0], linesize[0], 0, src->height);
+        return 0;
+    }
+    video_dec->present_sws = _GetSwsContext(
+        video_dec->present_sws,
+        src->width,
+        src->height,
+        src->width,
+        src->height,
+        src->format,
+        out_fmt,
+        video_dec->sws_flags);
+    if(video_dec->present_sws == NULL) {
+        return 1;
+    }
+    sws_scale(
+        video_dec->present_sws,
+        (const unsigned char * const *)src->data,
+        src->linesize,
+        0,
+        src->height,
+        data,
+        linesize);
+    return 0;
+}
+
+static int _UploadFrameDirect(Kit_Decoder *dec, Kit_VideoDecoder *video_dec, SDL_Texture *texture, const AVFrame *frame) {
+    enum AVPixelFormat out_fmt = _FindAVPixelFormat(dec->output.format);
+    uint8_t *data[4];
+    int linesize[4];
+    Uint32 tex_fmt;
+    int access;
+    int tex_w;
+    int tex_h;
+
+    // Only streaming textures of our own format can be written into.
+    if(SDL_QueryTexture(texture, &tex_fmt, &access, &tex_w, &tex_h) < 0) {
+        return 1;
+    }
+    if(access != SDL_TEXTUREACCESS_STREAMING
+            || tex_fmt != dec->output.format
+            || frame->width > tex_w
+            || frame->height > tex_h) {
+        return 1;
+    }
+
+    if(_LockTexturePlanes(texture, tex_fmt, tex_h, data, linesize)) {
+        return 1;
+    }
+    if(frame->format == out_fmt) {
+        av_image_copy(
+            data, linesize,
+            (const uint8_t **)frame->data, frame->linesize,
+            out_fmt, frame->width, frame->height);
+    } else if(_ConvertPresentFrame(video_dec, frame, out_fmt, data, linesize) != 0) {
+        SDL_UnlockTexture(texture);
+        return 1;
+    }
+    SDL_UnlockTexture(texture);
+    return 0;
+}
+
+static const AVFrame* _GetUploadFrame(Kit_Decoder *dec, Kit_VideoDecoder *video_dec, const AVFrame *frame) {
+    enum AVPixelFormat out_fmt = _FindAVPixelFormat(dec->output.format);
+    AVFrame *upload = video_dec->upload_frame;
+    if(frame->format == out_fmt) {
+        return frame;
+    }
+
+    // Passed-through frame going to a texture we cannot lock; convert it to a frame that is kept
+    // around for this, and upload from there.
+    if(upload == NULL) {
+        upload = video_dec->upload_frame = av_frame_alloc();
+        if(upload == NULL) {
+            return NULL;
+        }
+    }
+    if(upload->width != frame->width || upload->height != frame->height || upload->format != out_fmt) {
+        Kit_RemoveMemory(dec->memory, KIT_MEMORY_VIDEO, video_dec->upload_bytes);
+        video_dec->upload_bytes = 0;
+        av_frame_unref(upload);
+        upload->width = frame->width;
+        upload->height = frame->height;
+        upload->format = out_fmt;
+        if(av_frame_get_buffer(upload, 1) < 0) {
+            av_frame_unref(upload);
+            return NULL;
+        }
+        video_dec->upload_bytes = _GetFrameBytes(upload);
+        Kit_AddMemory(dec->memory, KIT_MEMORY_VIDEO, video_dec->upload_bytes);
+    }
+    if(_ConvertPresentFrame(video_dec, frame, out_fmt, upload->data, upload->linesize) != 0) {
+        return NULL;
+    }
+    return upload;
+}
+
+static void _UpdateTexture(const Kit_Decoder *dec, SDL_Texture *texture, const SDL_Rect *area, const AVFrame *frame) {
+    switch(dec->output.format) {
+        case SDL_PIXELFORMAT_YV12:
+        case SDL_PIXELFORMAT_IYUV:
+            SDL_UpdateYUVTexture(
+                texture, area,
+                frame->data[0], frame->linesize[0],
+                frame->data[1], frame->linesize[1],
+                frame->data[2], frame->linesize[2]);
+            break;
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+        case SDL_PIXELFORMAT_NV12:
+        case SDL_PIXELFORMAT_NV21:
+            SDL_UpdateNVTexture(
+                texture, area,
+                frame->data[0], frame->linesize[0],
+                frame->data[1], frame->linesize[1]);
+            break;
+#endif
+        default:
+            SDL_UpdateTexture(
+                texture, area,
+                frame->data[0],
+                frame->linesize[0]);
+            break;
+    }
+}
+
+static bool _CanPassThrough(enum AVPixelFormat fmt) {
+#if !SDL_VERSION_ATLEAST(2, 0, 16)
+    // Without SDL_UpdateNVTexture(), the chroma plane has to follow the luma plane with the same
+    // pitch. Only our own frames are laid out like that, so decoder frames get copied.
+    if(fmt == AV_PIX_FMT_NV12 || fmt == AV_PIX_FMT_NV21)
+        return false;
+#endif
+    return true;
+}
+
+static void _UpdateConvertTime(Kit_VideoDecoder *video_dec, Uint64 start) {
+    // Smoothed over roughly the last 16 frames; only the decoder thread writes this.
+    Uint64 elapsed = (SDL_GetPerformanceCounter() - start) * 1000000 / SDL_GetPerformanceFrequency();
+    int us = elapsed > INT_MAX ? INT_MAX : (int)elapsed;
+    int avg = SDL_AtomicGet(&video_dec->convert_us);
+    SDL_AtomicSet(&video_dec->convert_us, avg == 0 ? us : avg + (us - avg) / 16);
+}
+
+static void dec_read_video(Kit_Decoder *dec) {
     Kit_VideoDecoder *video_dec = dec->userdata;
     AVFrame *out_frame = NULL;
     Kit_VideoPacket *out_packet = NULL;
+    size_t borrowed_bytes;
+    Uint64 convert_start;
     double pts;
+    int out_w;
+    int out_h;
     int ret = 0;
 
     while(!ret && Kit_CanWriteDecoderOutput(dec)) {
         ret = avcodec_receive_frame(dec->codec_ctx, video_dec->scratch_frame);
         if(!ret) {
-            out_frame = av_frame_alloc();
-            av_image_alloc(
-                    out_frame->data,
-                    out_frame->linesize,
-                    dec->codec_ctx->width,
-                    dec->codec_ctx->height,
-                    _FindAVPixelFormat(dec->output.format),
-                    1);
-
-            // Scale from source format to target format, don't touch the size
-            video_dec->sws = _GetSwsContext(
-                video_dec->sws,
-                video_dec->scratch_frame->width,
-                video_dec->scratch_frame->height,
-                video_dec->scratch_frame->width,
-                video_dec->scratch_frame->height,
-                dec->codec_ctx->pix_fmt,
-                _FindAVPixelFormat(dec->output.format));
-            sws_scale(
-                video_dec->sws,
-                (const unsigned char * const *)video_dec->scratch_frame->data,
-                video_dec->scratch_frame->linesize,
-                0,
-                video_dec->scratch_frame->height,
-                out_frame->data,
-                out_frame->linesize);
-
-            // Copy required props to safety
-            out_frame->width = video_dec->scratch_frame->width;
-            out_frame->height = video_dec->scratch_frame->height;
-            out_frame->sample_aspect_ratio = video_dec->scratch_frame->sample_aspect_ratio;
-
             // Get presentation timestamp
             pts = video_dec->scratch_frame->best_effort_timestamp;
             pts *= av_q2d(dec->format_ctx->streams[dec->stream_index]->time_base);
 
-            // Lock, write to audio buffer, unlock
+            // If the decoder already gives us the output format and size, just take over its frame.
+            // Same with direct uploads, where format conversion is done when the frame is presented.
+            // Otherwise convert (and scale) it to our own frame.
+            borrowed_bytes = 0;
+            _GetOutputSize(
+                video_dec, video_dec->scratch_frame->width, video_dec->scratch_frame->height, &out_w, &out_h);
+            if(out_w == video_dec->scratch_frame->width
+                    && out_h == video_dec->scratch_frame->height
+                    && _CanPassThrough(video_dec->scratch_frame->format)
+                    && (video_dec->direct_upload
+                        || video_dec->scratch_frame->format == _FindAVPixelFormat(dec->output.format))) {
+                out_frame = av_frame_alloc();
+                if(out_frame != NULL) {
+                    av_frame_move_ref(out_frame, video_dec->scratch_frame);
+                    borrowed_bytes = _GetFrameBytes(out_frame);
+                }
+            } else {
+                convert_start = SDL_GetPerformanceCounter();
+                out_frame = _ConvertFrame(dec, video_dec, out_w, out_h);
+                _UpdateConvertTime(video_dec, convert_start);
+            }
+            if(out_frame == NULL) {
+                Kit_SetError("Unable to allocate video output frame");
+                return;
+            }
+
+            // Write to video buffer. Frame size and duration count against the buffer limits.
             out_packet = _CreateVideoPacket(out_frame, pts);
-            Kit_WriteDecoderOutput(dec, out_packet);
+            if(borrowed_bytes > 0) {
+                out_packet->borrowed_bytes = borrowed_bytes;
+                out_packet->memory = dec->memory;
+                Kit_AddMemory(out_packet->memory, KIT_MEMORY_VIDEO, borrowed_bytes);
+            }
+            Kit_WriteDecoderOutputItem(
+                dec, out_packet, (unsigned int)_GetFrameBytes(out_frame), video_dec->frame_duration);
+            dec->decoded_pts = pts;
+            video_dec->has_decoded = true;
         }
     }
 }
 
+static double _ClampLateness(double lateness) {
+    // Only the sign and rough size matter, so clamp it to keep it well in int range.
+    if(lateness > 60.0) {
+        return 60.0;
+    } else if(lateness < -60.0) {
+        return -60.0;
+    }
+    return lateness;
+}
+
+static void _SetSkipLevel(Kit_Decoder *dec, Kit_VideoDecoder *video_dec, int level) {
+    video_dec->skip_level = level;
+    video_dec->skip_changed = _GetSystemTime();
+    dec->codec_ctx->skip_frame = skip_levels[level].skip_frame;
+    dec->codec_ctx->skip_loop_filter = skip_levels[level].skip_loop_filter;
+    if(dec->codec_ctx->skip_loop_filter < video_dec->base_skip_loop_filter) {
+        dec->codec_ctx->skip_loop_filter = video_dec->base_skip_loop_filter;
+    }
+}
+
+static void _UpdateSkipLevel(Kit_Decoder *dec, Kit_VideoDecoder *video_dec) {
+    // Frames already in the output buffer were decoded with the old level, so give each level
+    // some time to show its effect before changing again.
+    double lateness = SDL_AtomicGet(&video_dec->lateness_ms) / 1000.0;
+    int max_level = sizeof(skip_levels) / sizeof(skip_levels[0]) - 1;
+    if(_GetSystemTime() - video_dec->skip_changed < KIT_VIDEO_SKIP_HOLD) {
+        return;
+    }
+
+    // Presenting thread only measures lateness while there are frames to present. Once the
+    // output has run dry, that value goes stale; estimate it from the clock and the frame
+    // following the newest decoded one instead.
+    if(Kit_IsDecoderOutputEmpty(dec)) {
+        lateness = 0;
+        if(video_dec->has_decoded) {
+            double sync_ts = _GetSystemTime() - dec->clock_sync;
+            lateness = _ClampLateness(sync_ts - (dec->decoded_pts + video_dec->frame_duration));
+        }
+        SDL_AtomicSet(&video_dec->lateness_ms, (int)(lateness * 1000));
+    }
+    if(lateness > KIT_VIDEO_SKIP_RAISE && video_dec->skip_level < max_level) {
+        _SetSkipLevel(dec, video_dec, video_dec->skip_level + 1);
+    } else if(lateness < KIT_VIDEO_SKIP_LOWER && video_dec->skip_level > 0) {
+        _SetSkipLevel(dec, video_dec, video_dec->skip_level - 1);
+    }
+}
+
 static int dec_decode_video_cb(Kit_Decoder *dec, AVPacket *in_packet) {
     assert(dec != NULL);
     assert(in_packet != NULL);
@@ -180,6 +746,10 @@ static int dec_decode_video_cb(Kit_Decoder *dec, AVPacket *in_packet) {
     // so we want to clear it of outgoing data if we can.
     dec_read_video(dec);
 
+    // If playback is falling behind, let the codec cut corners (or drop frames) before decoding
+    // rather than throwing away finished frames later.
+    _UpdateSkipLevel(dec, dec->userdata);
+
     // Write packet to the decoder for handling.
     if(avcodec_send_packet(dec->codec_ctx, in_packet) < 0) {
         return 1;
@@ -190,6 +760,44 @@ static int dec_decode_video_cb(Kit_Decoder *dec, AVPacket *in_packet) {
     return 0;
 }
 
+static void dec_flush_video_cb(Kit_Decoder *dec) {
+    // Lateness measured before a seek says nothing about playback after it.
+    Kit_VideoDecoder *video_dec = dec->userdata;
+    SDL_AtomicSet(&video_dec->lateness_ms, 0);
+    video_dec->has_decoded = false;
+    _SetSkipLevel(dec, video_dec, 0);
+}
+
+static void dec_suspend_video_cb(Kit_Decoder *dec) {
+    // Converter and frame pool are recreated on demand once decoding resumes. Buffers still
+    // leased to the caller keep the old pool alive until released.
+    Kit_VideoDecoder *video_dec = dec->userdata;
+    av_frame_unref(video_dec->scratch_frame);
+    if(video_dec->sws != NULL) {
+        sws_freeContext(video_dec->sws);
+        video_dec->sws = NULL;
+    }
+    av_buffer_pool_uninit(&video_dec->out_pool.pool);
+    _FreeSlicer(video_dec);
+
+    // Lease pool belongs to the presenting thread, which only touches it under the output lock.
+    Kit_LockDecoderOutput(dec);
+    av_buffer_pool_uninit(&video_dec->lease_pool.pool);
+    Kit_UnlockDecoderOutput(dec);
+}
+
+static int dec_resume_video_cb(Kit_Decoder *dec) {
+    // Codec context is new, so it starts out without shortcuts.
+    Kit_VideoDecoder *video_dec = dec->userdata;
+    SDL_AtomicSet(&video_dec->lateness_ms, 0);
+    video_dec->has_decoded = false;
+    video_dec->skip_level = 0;
+
+    // Sliced conversion is optional; without helpers, frames are just converted in one go.
+    _CreateSlicer(video_dec);
+    return 0;
+}
+
 static void dec_close_video_cb(Kit_Decoder *dec) {
     if(dec == NULL) return;
 
@@ -200,10 +808,20 @@ static void dec_close_video_cb(Kit_Decoder *dec) {
     if(video_dec->sws != NULL) {
         sws_freeContext(video_dec->sws);
     }
+    if(video_dec->present_sws != NULL) {
+        sws_freeContext(video_dec->present_sws);
+    }
+    if(video_dec->upload_frame != NULL) {
+        Kit_RemoveMemory(dec->memory, KIT_MEMORY_VIDEO, video_dec->upload_bytes);
+        av_frame_free(&video_dec->upload_frame);
+    }
+    av_buffer_pool_uninit(&video_dec->out_pool.pool);
+    av_buffer_pool_uninit(&video_dec->lease_pool.pool);
+    _FreeSlicer(video_dec);
     free(video_dec);
 }
 
-Kit_Decoder* Kit_CreateVideoDecoder(const Kit_Source *src, int stream_index) {
+Kit_Decoder* Kit_CreateVideoDecoder(const Kit_Source *src, int stream_index, Kit_MemoryCounter *memory) {
     assert(src != NULL);
     if(stream_index < 0) {
         return NULL;
@@ -217,16 +835,35 @@ Kit_Decoder* Kit_CreateVideoDecoder(const Kit_Source *src, int stream_index) {
         stream_index,
         state->video_buf_frames,
         free_out_video_packet_cb,
-        state->thread_count);
+        state->thread_count,
+        state->video_lowres,
+        memory);
     if(dec == NULL) {
         goto EXIT_0;
     }
 
+    Kit_SetDecoderInputLimits(dec, state->video_in_bytes, state->video_in_ms);
+    Kit_SetDecoderOutputLimits(dec, state->video_buf_bytes, state->video_buf_ms);
+
     // ... then allocate the video decoder
     Kit_VideoDecoder *video_dec = calloc(1, sizeof(Kit_VideoDecoder));
     if(video_dec == NULL) {
         goto EXIT_1;
     }
+    video_dec->direct_upload = state->video_direct_upload;
+    video_dec->sws_flags = _FindSwsFlags(state->scale_quality);
+    _CreateSlicer(video_dec);
+
+    // With low resolution decoding, the opened codec already reports the reduced size.
+    video_dec->base_skip_loop_filter = dec->codec_ctx->skip_loop_filter;
+    video_dec->decode_width = dec->codec_ctx->width;
+    video_dec->decode_height = dec->codec_ctx->height;
+
+    // Frame rate is only used for buffer limits, so it does not need to be exact.
+    AVRational frame_rate = dec->format_ctx->streams[stream_index]->avg_frame_rate;
+    if(frame_rate.num > 0 && frame_rate.den > 0) {
+        video_dec->frame_duration = 1.0 / av_q2d(frame_rate);
+    }
 
     // Create temporary video frame
     video_dec->scratch_frame = av_frame_alloc();
@@ -235,9 +872,12 @@ Kit_Decoder* Kit_CreateVideoDecoder(const Kit_Source *src, int stream_index) {
         goto EXIT_2;
     }
 
-    // Find best output format for us
+    // Find best output format for us, unless the caller wants RGBA regardless of the source.
     enum AVPixelFormat output_format = avcodec_find_best_pix_fmt_of_list(
         supported_list, dec->codec_ctx->pix_fmt, 1, NULL);
+    if(state->video_rgba_output) {
+        output_format = AV_PIX_FMT_RGBA;
+    }
 
     // Set format configs
     Kit_OutputFormat output;
@@ -254,7 +894,8 @@ Kit_Decoder* Kit_CreateVideoDecoder(const Kit_Source *src, int stream_index) {
         dec->codec_ctx->width,
         dec->codec_ctx->height,
         dec->codec_ctx->pix_fmt,
-        _FindAVPixelFormat(output.format)
+        _FindAVPixelFormat(output.format),
+        video_dec->sws_flags
     );
     if(video_dec->sws == NULL) {
         goto EXIT_3;
@@ -262,6 +903,9 @@ Kit_Decoder* Kit_CreateVideoDecoder(const Kit_Source *src, int stream_index) {
 
     // Set callbacks and userdata, and we're go
     dec->dec_decode = dec_decode_video_cb;
+    dec->dec_flush = dec_flush_video_cb;
+    dec->dec_suspend = dec_suspend_video_cb;
+    dec->dec_resume = dec_resume_video_cb;
     dec->dec_close = dec_close_video_cb;
     dec->userdata = video_dec;
     dec->output = output;
@@ -285,18 +929,30 @@ double Kit_GetVideoDecoderPTS(const Kit_Decoder *dec) {
     return packet->pts;
 }
 
-int Kit_GetVideoDecoderData(Kit_Decoder *dec, SDL_Texture *texture, SDL_Rect *area) {
+void Kit_SetVideoDecoderSize(Kit_Decoder *dec, int w, int h) {
     assert(dec != NULL);
-    assert(texture != NULL);
+    Kit_VideoDecoder *video_dec = dec->userdata;
+    if(w <= 0 || h <= 0 || w > 0xFFFF || h > 0xFFFF) {
+        w = h = 0;
+    }
+    SDL_AtomicSet(&video_dec->output_size, (w << 16) | h);
+
+    // Reported size follows right away, decoded frames follow once the decoder gets to them.
+    dec->output.width = w > 0 ? w : video_dec->decode_width;
+    dec->output.height = h > 0 ? h : video_dec->decode_height;
+}
 
+static Kit_VideoPacket* _PeekSyncedPacket(Kit_Decoder *dec) {
+    Kit_VideoDecoder *video_dec = dec->userdata;
     Kit_VideoPacket *packet = NULL;
     double sync_ts = 0;
+    double lateness = 0;
     unsigned int limit_rounds = 0;
 
     // First, peek the next packet. Make sure we have something to read.
     packet = Kit_PeekDecoderOutput(dec);
     if(packet == NULL) {
-        return 0;
+        return NULL;
     }
 
     // If packet should not yet be played, stop here and wait.
@@ -304,8 +960,13 @@ int Kit_GetVideoDecoderData(Kit_Decoder *dec, SDL_Texture *texture, SDL_Rect *ar
     // For video, we *try* to return a frame, even if we are out of sync. It is better than
     // not showing anything.
     sync_ts = _GetSystemTime() - dec->clock_sync;
+
+    // Lateness of the oldest buffered frame tells the decoder thread whether it is keeping up.
+    lateness = _ClampLateness(sync_ts - packet->pts);
+    SDL_AtomicSet(&video_dec->lateness_ms, (int)(lateness * 1000));
+
     if(packet->pts > sync_ts + KIT_VIDEO_SYNC_THRESHOLD) {
-        return 0;
+        return NULL;
     }
     limit_rounds = Kit_GetDecoderOutputLength(dec);
     while(packet != NULL && packet->pts < sync_ts - KIT_VIDEO_SYNC_THRESHOLD && --limit_rounds) {
@@ -313,6 +974,90 @@ int Kit_GetVideoDecoderData(Kit_Decoder *dec, SDL_Texture *texture, SDL_Rect *ar
         free_out_video_packet_cb(packet);
         packet = Kit_PeekDecoderOutput(dec);
     }
+    return packet;
+}
+
+static int _ConvertPacketFrame(Kit_Decoder *dec, Kit_VideoDecoder *video_dec, Kit_VideoPacket *packet) {
+    enum AVPixelFormat out_fmt = _FindAVPixelFormat(dec->output.format);
+    AVFrame *src = packet->frame;
+    AVFrame *dst = _AllocPoolFrame(dec->memory, &video_dec->lease_pool, src->width, src->height, out_fmt);
+    if(dst == NULL) {
+        return 1;
+    }
+    if(_ConvertPresentFrame(video_dec, src, out_fmt, dst->data, dst->linesize) != 0) {
+        av_frame_free(&dst);
+        return 1;
+    }
+    dst->sample_aspect_ratio = src->sample_aspect_ratio;
+
+    // Converted frame replaces the decoded one. Its buffer is accounted by the pool it came from.
+    if(packet->borrowed_bytes > 0) {
+        Kit_RemoveMemory(packet->memory, KIT_MEMORY_VIDEO, packet->borrowed_bytes);
+    }
+    packet->borrowed_bytes = 0;
+    av_frame_free(&packet->frame);
+    packet->frame = dst;
+    return 0;
+}
+
+double Kit_GetVideoDecoderConvertTime(const Kit_Decoder *dec) {
+    if(dec == NULL) return 0;
+    const Kit_VideoDecoder *video_dec = dec->userdata;
+    return SDL_AtomicGet((SDL_atomic_t*)&video_dec->convert_us) / 1000000.0;
+}
+
+int Kit_AcquireVideoDecoderFrame(Kit_Decoder *dec, Kit_VideoFrame *frame) {
+    assert(dec != NULL);
+    assert(frame != NULL);
+
+    Kit_VideoDecoder *video_dec = dec->userdata;
+    Kit_VideoPacket *packet = _PeekSyncedPacket(dec);
+    if(packet == NULL) {
+        return 0;
+    }
+
+    // Packet leaves the buffer, and is owned by the caller until released. Passed-through frames
+    // of the wrong format (direct uploads) are the only ones that need converting.
+    Kit_AdvanceDecoderOutput(dec);
+    dec->clock_pos = packet->pts;
+    dec->aspect_ratio = packet->frame->sample_aspect_ratio;
+    if(packet->frame->format != _FindAVPixelFormat(dec->output.format)
+            && _ConvertPacketFrame(dec, video_dec, packet) != 0) {
+        Kit_SetError("Unable to convert leased video frame");
+        free_out_video_packet_cb(packet);
+        return 0;
+    }
+
+    memset(frame, 0, sizeof(Kit_VideoFrame));
+    for(int i = 0; i < 4; i++) {
+        frame->data[i] = packet->frame->data[i];
+        frame->pitch[i] = packet->frame->linesize[i];
+    }
+    frame->format = dec->output.format;
+    frame->width = packet->frame->width;
+    frame->height = packet->frame->height;
+    frame->pts = packet->pts;
+    frame->handle = packet;
+    return 1;
+}
+
+void Kit_ReleaseVideoDecoderFrame(Kit_VideoFrame *frame) {
+    assert(frame != NULL);
+    if(frame->handle != NULL) {
+        free_out_video_packet_cb(frame->handle);
+    }
+    memset(frame, 0, sizeof(Kit_VideoFrame));
+}
+
+int Kit_GetVideoDecoderData(Kit_Decoder *dec, SDL_Texture *texture, SDL_Rect *area) {
+    assert(dec != NULL);
+    assert(texture != NULL);
+
+    Kit_VideoDecoder *video_dec = dec->userdata;
+    Kit_VideoPacket *packet = NULL;
+    const AVFrame *frame = NULL;
+
+    packet = _PeekSyncedPacket(dec);
     if(packet == NULL) {
         return 0;
     }
@@ -323,21 +1068,11 @@ int Kit_GetVideoDecoderData(Kit_Decoder *dec, SDL_Texture *texture, SDL_Rect *ar
     area->h = packet->frame->height;
     area->x = 0;
     area->y = 0;
-    switch(dec->output.format) {
-        case SDL_PIXELFORMAT_YV12:
-        case SDL_PIXELFORMAT_IYUV:
-            SDL_UpdateYUVTexture(
-                texture, area,
-                packet->frame->data[0], packet->frame->linesize[0],
-                packet->frame->data[1], packet->frame->linesize[1],
-                packet->frame->data[2], packet->frame->linesize[2]);
-            break;
-        default:
-            SDL_UpdateTexture(
-                texture, area,
-                packet->frame->data[0],
-                packet->frame->linesize[0]);
-            break;
+    if(!video_dec->direct_upload || _UploadFrameDirect(dec, video_dec, texture, packet->frame) != 0) {
+        frame = _GetUploadFrame(dec, video_dec, packet->frame);
+        if(frame != NULL) {
+            _UpdateTexture(dec, texture, area, frame);
+        }
     }
 
     // Advance buffer, and free the decoded frame.
@@ -0,0 +1,367 @@
+#include <string.h>
+
+#include <SDL_cpuinfo.h>
+
+#include "kitchensink/internal/video/kityuv.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define KIT_YUV_X86
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define KIT_TARGET_SSE2 __attribute__((target("sse2")))
+#define KIT_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define KIT_TARGET_SSE2
+#define KIT_TARGET_AVX2
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define KIT_YUV_NEON
+#include <arm_neon.h>
+#endif
+
+#define KIT_YUV_SHIFT 12
+#define KIT_YUV_ROUND (1 << (KIT_YUV_SHIFT - 1))
+#define KIT_YUV_CHUNK 512  // Pixels per deinterleaved NV12 chunk; must be even
+
+#define Q(x) ((short)((x) * (1 << KIT_YUV_SHIFT) + 0.5))
+
+// Indexed by [full range][BT.709]. Limited range chroma scaling is folded into the coefficients.
+static const Kit_YUVCoeffs _Coeffs[2][2] = {
+    {
+        {16, Q(1.164383), Q(1.596027), Q(0.391762), Q(0.812968), Q(2.017232), false},
+        {16, Q(1.164383), Q(1.792741), Q(0.213249), Q(0.532909), Q(2.112402), false},
+    },
+    {
+        {0, Q(1.0), Q(1.402), Q(0.344136), Q(0.714136), Q(1.772), false},
+        {0, Q(1.0), Q(1.5748), Q(0.187324), Q(0.468124), Q(1.8556), false},
+    },
+};
+
+static unsigned char _Clamp(int value) {
+    return value < 0 ? 0 : (value > 255 ? 255 : (unsigned char)value);
+}
+
+// Reference implementation. SIMD kernels use this for the pixels left over at the end of a row.
+static void _ConvertRowC(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                         unsigned char *dst, int width, const Kit_YUVCoeffs *c) {
+    int yy, uu, vv;
+    unsigned char r, g, b;
+    for(int x = 0; x < width; x++) {
+        yy = (y[x] - c->y_offset) * c->y_mul;
+        uu = u[x >> 1] - 128;
+        vv = v[x >> 1] - 128;
+        r = _Clamp((yy + c->v_to_r * vv + KIT_YUV_ROUND) >> KIT_YUV_SHIFT);
+        g = _Clamp((yy - c->u_to_g * uu - c->v_to_g * vv + KIT_YUV_ROUND) >> KIT_YUV_SHIFT);
+        b = _Clamp((yy + c->u_to_b * uu + KIT_YUV_ROUND) >> KIT_YUV_SHIFT);
+        dst[0] = c->bgra ? b : r;
+        dst[1] = g;
+        dst[2] = c->bgra ? r : b;
+        dst[3] = 255;
+        dst += 4;
+    }
+}
+
+#ifdef KIT_YUV_X86
+
+// Multiplier pair for _mm_madd_epi16, a goes with the even (first) lane.
+static int _Pair(short a, short b) {
+    return (int)(((unsigned int)(unsigned short)b << 16) | (unsigned short)a);
+}
+
+KIT_TARGET_SSE2 static __m128i _RoundSSE2(__m128i lo, __m128i hi) {
+    const __m128i round = _mm_set1_epi32(KIT_YUV_ROUND);
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, round), KIT_YUV_SHIFT);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, round), KIT_YUV_SHIFT);
+    return _mm_packs_epi32(lo, hi);
+}
+
+// Computes (a * k_a + b * k_b) for 8 pixels, rounded and shifted down.
+KIT_TARGET_SSE2 static __m128i _Dot2SSE2(__m128i a, __m128i b, __m128i k) {
+    return _RoundSSE2(
+        _mm_madd_epi16(_mm_unpacklo_epi16(a, b), k),
+        _mm_madd_epi16(_mm_unpackhi_epi16(a, b), k));
+}
+
+// Computes (a * k_a + b * k_b + c * k_c) for 8 pixels, rounded and shifted down.
+KIT_TARGET_SSE2 static __m128i _Dot3SSE2(__m128i a, __m128i b, __m128i c, __m128i k_ab, __m128i k_c) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi32(
+        _mm_madd_epi16(_mm_unpacklo_epi16(a, b), k_ab),
+        _mm_madd_epi16(_mm_unpacklo_epi16(c, zero), k_c));
+    __m128i hi = _mm_add_epi32(
+        _mm_madd_epi16(_mm_unpackhi_epi16(a, b), k_ab),
+        _mm_madd_epi16(_mm_unpackhi_epi16(c, zero), k_c));
+    return _RoundSSE2(lo, hi);
+}
+
+// Interleaves 16 pixels of 8-bit channels to 4-byte pixels.
+KIT_TARGET_SSE2 static void _Store16SSE2(unsigned char *dst, __m128i c0, __m128i c1, __m128i c2, __m128i c3) {
+    __m128i lo01 = _mm_unpacklo_epi8(c0, c1);
+    __m128i hi01 = _mm_unpackhi_epi8(c0, c1);
+    __m128i lo23 = _mm_unpacklo_epi8(c2, c3);
+    __m128i hi23 = _mm_unpackhi_epi8(c2, c3);
+    _mm_storeu_si128((__m128i*)(dst + 0), _mm_unpacklo_epi16(lo01, lo23));
+    _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(lo01, lo23));
+    _mm_storeu_si128((__m128i*)(dst + 32), _mm_unpacklo_epi16(hi01, hi23));
+    _mm_storeu_si128((__m128i*)(dst + 48), _mm_unpackhi_epi16(hi01, hi23));
+}
+
+KIT_TARGET_SSE2 static void _ConvertRowSSE2(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                                            unsigned char *dst, int width, const Kit_YUVCoeffs *c) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi8((char)0xFF);
+    const __m128i y_offset = _mm_set1_epi16(c->y_offset);
+    const __m128i uv_offset = _mm_set1_epi16(128);
+    const __m128i k_r = _mm_set1_epi32(_Pair(c->y_mul, c->v_to_r));
+    const __m128i k_g = _mm_set1_epi32(_Pair(c->y_mul, (short)-c->u_to_g));
+    const __m128i k_gv = _mm_set1_epi32(_Pair((short)-c->v_to_g, 0));
+    const __m128i k_b = _mm_set1_epi32(_Pair(c->y_mul, c->u_to_b));
+    __m128i y16, u16, v16, r8, g8, b8, tmp;
+    int uv4;
+    int x = 0;
+
+    for(; x + 8 <= width; x += 8) {
+        y16 = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(y + x)), zero), y_offset);
+        memcpy(&uv4, u + x / 2, 4);
+        tmp = _mm_cvtsi32_si128(uv4);
+        u16 = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_unpacklo_epi8(tmp, tmp), zero), uv_offset);
+        memcpy(&uv4, v + x / 2, 4);
+        tmp = _mm_cvtsi32_si128(uv4);
+        v16 = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_unpacklo_epi8(tmp, tmp), zero), uv_offset);
+
+        r8 = _Dot2SSE2(y16, v16, k_r);
+        g8 = _Dot3SSE2(y16, u16, v16, k_g, k_gv);
+        b8 = _Dot2SSE2(y16, u16, k_b);
+        r8 = _mm_packus_epi16(r8, r8);
+        g8 = _mm_packus_epi16(g8, g8);
+        b8 = _mm_packus_epi16(b8, b8);
+
+        // Only the low 8 pixels are valid; store those.
+        tmp = c->bgra ? _mm_unpacklo_epi8(b8, g8) : _mm_unpacklo_epi8(r8, g8);
+        r8 = _mm_unpacklo_epi8(c->bgra ? r8 : b8, alpha);
+        _mm_storeu_si128((__m128i*)(dst + x * 4), _mm_unpacklo_epi16(tmp, r8));
+        _mm_storeu_si128((__m128i*)(dst + x * 4 + 16), _mm_unpackhi_epi16(tmp, r8));
+    }
+    _ConvertRowC(y + x, u + x / 2, v + x / 2, dst + x * 4, width - x, c);
+}
+
+KIT_TARGET_AVX2 static __m256i _RoundAVX2(__m256i lo, __m256i hi) {
+    const __m256i round = _mm256_set1_epi32(KIT_YUV_ROUND);
+    lo = _mm256_srai_epi32(_mm256_add_epi32(lo, round), KIT_YUV_SHIFT);
+    hi = _mm256_srai_epi32(_mm256_add_epi32(hi, round), KIT_YUV_SHIFT);
+    return _mm256_packs_epi32(lo, hi);  // In-lane unpack and pack cancel out; pixels stay in order
+}
+
+KIT_TARGET_AVX2 static __m256i _Dot2AVX2(__m256i a, __m256i b, __m256i k) {
+    return _RoundAVX2(
+        _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), k),
+        _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), k));
+}
+
+KIT_TARGET_AVX2 static __m256i _Dot3AVX2(__m256i a, __m256i b, __m256i c, __m256i k_ab, __m256i k_c) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_add_epi32(
+        _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), k_ab),
+        _mm256_madd_epi16(_mm256_unpacklo_epi16(c, zero), k_c));
+    __m256i hi = _mm256_add_epi32(
+        _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), k_ab),
+        _mm256_madd_epi16(_mm256_unpackhi_epi16(c, zero), k_c));
+    return _RoundAVX2(lo, hi);
+}
+
+KIT_TARGET_AVX2 static __m128i _PackAVX2(__m256i value) {
+    return _mm_packus_epi16(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+}
+
+KIT_TARGET_AVX2 static void _ConvertRowAVX2(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                                            unsigned char *dst, int width, const Kit_YUVCoeffs *c) {
+    const __m128i alpha = _mm_set1_epi8((char)0xFF);
+    const __m256i y_offset = _mm256_set1_epi16(c->y_offset);
+    const __m256i uv_offset = _mm256_set1_epi16(128);
+    const __m256i k_r = _mm256_set1_epi32(_Pair(c->y_mul, c->v_to_r));
+    const __m256i k_g = _mm256_set1_epi32(_Pair(c->y_mul, (short)-c->u_to_g));
+    const __m256i k_gv = _mm256_set1_epi32(_Pair((short)-c->v_to_g, 0));
+    const __m256i k_b = _mm256_set1_epi32(_Pair(c->y_mul, c->u_to_b));
+    __m256i y16, u16, v16;
+    __m128i r8, g8, b8, tmp;
+    int x = 0;
+
+    for(; x + 16 <= width; x += 16) {
+        y16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + x))), y_offset);
+        tmp = _mm_loadl_epi64((const __m128i*)(u + x / 2));
+        u16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(tmp, tmp)), uv_offset);
+        tmp = _mm_loadl_epi64((const __m128i*)(v + x / 2));
+        v16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(tmp, tmp)), uv_offset);
+
+        r8 = _PackAVX2(_Dot2AVX2(y16, v16, k_r));
+        g8 = _PackAVX2(_Dot3AVX2(y16, u16, v16, k_g, k_gv));
+        b8 = _PackAVX2(_Dot2AVX2(y16, u16, k_b));
+        if(c->bgra) {
+            _Store16SSE2(dst + x * 4, b8, g8, r8, alpha);
+        } else {
+            _Store16SSE2(dst + x * 4, r8, g8, b8, alpha);
+        }
+    }
+    _ConvertRowC(y + x, u + x / 2, v + x / 2, dst + x * 4, width - x, c);
+}
+
+#endif // KIT_YUV_X86
+
+#ifdef KIT_YUV_NEON
+
+static int16x8_t _LoadChromaNEON(const unsigned char *p) {
+    uint32_t uv4;
+    memcpy(&uv4, p, 4);
+    uint8x8_t tmp = vreinterpret_u8_u32(vdup_n_u32(uv4));
+    tmp = vzip_u8(tmp, tmp).val[0];
+    return vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(tmp)), vdupq_n_s16(128));
+}
+
+static void _ConvertRowNEON(const unsigned char *y, const unsigned char *u, const unsigned char *v,
+                            unsigned char *dst, int width, const Kit_YUVCoeffs *c) {
+    int16x8_t y16, u16, v16;
+    int32x4_t lo, hi;
+    uint8x8_t r8, g8, b8;
+    uint8x8x4_t px;
+    int x = 0;
+
+    px.val[3] = vdup_n_u8(255);
+    for(; x + 8 <= width; x += 8) {
+        y16 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(y + x))), vdupq_n_s16(c->y_offset));
+        u16 = _LoadChromaNEON(u + x / 2);
+        v16 = _LoadChromaNEON(v + x / 2);
+
+        // Rounding narrow does the same (x + round) >> shift as the C version.
+        lo = vmlal_n_s16(vmull_n_s16(vget_low_s16(y16), c->y_mul), vget_low_s16(v16), c->v_to_r);
+        hi = vmlal_n_s16(vmull_n_s16(vget_high_s16(y16), c->y_mul), vget_high_s16(v16), c->v_to_r);
+        r8 = vqmovun_s16(vcombine_s16(vqrshrn_n_s32(lo, KIT_YUV_SHIFT), vqrshrn_n_s32(hi, KIT_YUV_SHIFT)));
+
+        lo = vmull_n_s16(vget_low_s16(y16), c->y_mul);
+        hi = vmull_n_s16(vget_high_s16(y16), c->y_mul);
+        lo = vmlsl_n_s16(vmlsl_n_s16(lo, vget_low_s16(u16), c->u_to_g), vget_low_s16(v16), c->v_to_g);
+        hi = vmlsl_n_s16(vmlsl_n_s16(hi, vget_high_s16(u16), c->u_to_g), vget_high_s16(v16), c->v_to_g);
+        g8 = vqmovun_s16(vcombine_s16(vqrshrn_n_s32(lo, KIT_YUV_SHIFT), vqrshrn_n_s32(hi, KIT_YUV_SHIFT)));
+
+        lo = vmlal_n_s16(vmull_n_s16(vget_low_s16(y16), c->y_mul), vget_low_s16(u16), c->u_to_b);
+        hi = vmlal_n_s16(vmull_n_s16(vget_high_s16(y16), c->y_mul), vget_high_s16(u16), c->u_to_b);
+        b8 = vqmovun_s16(vcombine_s16(vqrshrn_n_s32(lo, KIT_YUV_SHIFT), vqrshrn_n_s32(hi, KIT_YUV_SHIFT)));
+
+        px.val[0] = c->bgra ? b8 : r8;
+        px.val[1] = g8;
+        px.val[2] = c->bgra ? r8 : b8;
+        vst4_u8(dst + x * 4, px);
+    }
+    _ConvertRowC(y + x, u + x / 2, v + x / 2, dst + x * 4, width - x, c);
+}
+
+#endif // KIT_YUV_NEON
+
+typedef struct Kit_YUVKernel {
+    const char *name;
+    Kit_YUVRowFunc row;
+    SDL_bool (*supported)(void);  ///< CPU feature check, or NULL if always usable
+} Kit_YUVKernel;
+
+// Fastest first. Plain C is last, and always usable.
+static const Kit_YUVKernel _Kernels[] = {
+#ifdef KIT_YUV_X86
+    {"avx2", _ConvertRowAVX2, SDL_HasAVX2},
+    {"sse2", _ConvertRowSSE2, SDL_HasSSE2},
+#endif
+#ifdef KIT_YUV_NEON
+    {"neon", _ConvertRowNEON, SDL_HasNEON},
+#endif
+    {"c", _ConvertRowC, NULL},
+};
+
+/**
+  * Lists the row kernels usable on this CPU, fastest first. Used for checking that they all
+  * give the same output; conversions always use the first one.
+  * @param index Kernel index, starting from 0
+  * @param name Set to the kernel name, if not NULL
+  * @return Kernel, or NULL if index is past the last one
+  */
+Kit_YUVRowFunc Kit_GetYUVRowFunc(int index, const char **name) {
+    for(size_t i = 0; i < sizeof(_Kernels) / sizeof(_Kernels[0]); i++) {
+        if(_Kernels[i].supported != NULL && !_Kernels[i].supported())
+            continue;
+        if(index-- > 0)
+            continue;
+        if(name != NULL)
+            *name = _Kernels[i].name;
+        return _Kernels[i].row;
+    }
+    return NULL;
+}
+
+/**
+  * Sets up a converter for the given source frame, if its format is supported.
+  * @param conv Converter to set up
+  * @param src Source frame; format, colorspace and range are read from this
+  * @param out_fmt Target pixel format
+  * @return True if the conversion can be done, false if swscale should be used instead
+  */
+bool Kit_InitYUVConverter(Kit_YUVConverter *conv, const AVFrame *src, enum AVPixelFormat out_fmt) {
+    bool full_range;
+    if(out_fmt != AV_PIX_FMT_RGBA && out_fmt != AV_PIX_FMT_BGRA)
+        return false;
+    switch(src->format) {
+        case AV_PIX_FMT_YUV420P:
+        case AV_PIX_FMT_NV12:
+            full_range = src->color_range == AVCOL_RANGE_JPEG;
+            break;
+        case AV_PIX_FMT_YUVJ420P:
+            full_range = true;
+            break;
+        default:
+            return false;
+    }
+
+    // Anything not tagged as BT.709 is treated as BT.601, like swscale does.
+    conv->coeffs = _Coeffs[full_range ? 1 : 0][src->colorspace == AVCOL_SPC_BT709 ? 1 : 0];
+    conv->coeffs.bgra = out_fmt == AV_PIX_FMT_BGRA;
+    conv->nv12 = src->format == AV_PIX_FMT_NV12;
+    conv->row = Kit_GetYUVRowFunc(0, NULL);
+    return true;
+}
+
+/**
+  * Converts rows [y, y + h) of the source frame to a packed target image of the same size.
+  * Separate row ranges may be converted from different threads at the same time.
+  * @param conv Converter set up with Kit_InitYUVConverter()
+  * @param src Source frame
+  * @param dst Target image, 4 bytes per pixel
+  * @param dst_pitch Target row stride in bytes
+  * @param y First row to convert
+  * @param h Number of rows to convert
+  */
+void Kit_RunYUVConverter(const Kit_YUVConverter *conv, const AVFrame *src, unsigned char *dst, int dst_pitch, int y, int h) {
+    unsigned char u[KIT_YUV_CHUNK / 2];
+    unsigned char v[KIT_YUV_CHUNK / 2];
+    const unsigned char *y_row;
+    const unsigned char *uv_row;
+    unsigned char *dst_row;
+    int count;
+
+    for(int row = y; row < y + h; row++) {
+        y_row = src->data[0] + row * src->linesize[0];
+        uv_row = src->data[1] + (row >> 1) * src->linesize[1];
+        dst_row = dst + row * dst_pitch;
+        if(!conv->nv12) {
+            conv->row(y_row, uv_row, src->data[2] + (row >> 1) * src->linesize[2], dst_row, src->width, &conv->coeffs);
+            continue;
+        }
+
+        // Interleaved chroma is split to planes a chunk at a time, so that the kernels stay simple.
+        for(int x = 0; x < src->width; x += KIT_YUV_CHUNK) {
+            count = src->width - x < KIT_YUV_CHUNK ? src->width - x : KIT_YUV_CHUNK;
+            for(int i = 0; i < (count + 1) / 2; i++) {
+                u[i] = uv_row[x + i * 2];
+                v[i] = uv_row[x + i * 2 + 1];
+            }
+            conv->row(y_row + x, u, v, dst_row + x * 4, count, &conv->coeffs);
+        }
+    }
+}
@@ -3,6 +3,7 @@
 #include <SDL_loadso.h>
 #endif
 
+#include <SDL_cpuinfo.h>
 #include <libavformat/avformat.h>
 #include "libavcodec/avcodec.h"
 
@@ -87,6 +88,10 @@ void Kit_Quit() {
     if(state->init_flags & KIT_INIT_ASS) {
         Kit_CloseASS(state);
     }
+    Kit_CloseWorkerPool(state->worker_pool);
+    state->worker_pool = NULL;
+    Kit_CloseParallel(state->convert_runner);
+    state->convert_runner = NULL;
     state->init_flags = 0;
 }
 
@@ -108,6 +113,66 @@ void Kit_SetHint(Kit_HintType type, int value) {
         case KIT_HINT_SUBTITLE_BUFFER_FRAMES:
             state->subtitle_buf_frames = Kit_max(value, 1);
             break;
+        case KIT_HINT_WORKER_THREADS:
+            state->worker_threads = Kit_max(Kit_min(value, SDL_GetCPUCount()), 0);
+            break;
+        case KIT_HINT_MANUAL_PUMP:
+            state->manual_pump = Kit_max(Kit_min(value, 1), 0);
+            break;
+        case KIT_HINT_THREAD_PRIORITY:
+            state->thread_priority = Kit_max(Kit_min(value, KIT_THREAD_PRIORITY_COUNT - 1), 0);
+            break;
+        case KIT_HINT_THREAD_AFFINITY:
+            state->thread_affinity = (unsigned int)value;
+            break;
+        case KIT_HINT_VIDEO_BUFFER_BYTES:
+            state->video_buf_bytes = Kit_max(value, 0);
+            break;
+        case KIT_HINT_AUDIO_BUFFER_BYTES:
+            state->audio_buf_bytes = Kit_max(value, 0);
+            break;
+        case KIT_HINT_VIDEO_BUFFER_MS:
+            state->video_buf_ms = Kit_max(value, 0);
+            break;
+        case KIT_HINT_AUDIO_BUFFER_MS:
+            state->audio_buf_ms = Kit_max(value, 0);
+            break;
+        case KIT_HINT_VIDEO_DIRECT_UPLOAD:
+            state->video_direct_upload = Kit_max(Kit_min(value, 1), 0);
+            break;
+        case KIT_HINT_VIDEO_INPUT_BYTES:
+            state->video_in_bytes = Kit_max(value, 0);
+            break;
+        case KIT_HINT_AUDIO_INPUT_BYTES:
+            state->audio_in_bytes = Kit_max(value, 0);
+            break;
+        case KIT_HINT_SUBTITLE_INPUT_BYTES:
+            state->subtitle_in_bytes = Kit_max(value, 0);
+            break;
+        case KIT_HINT_VIDEO_INPUT_MS:
+            state->video_in_ms = Kit_max(value, 0);
+            break;
+        case KIT_HINT_AUDIO_INPUT_MS:
+            state->audio_in_ms = Kit_max(value, 0);
+            break;
+        case KIT_HINT_SUBTITLE_INPUT_MS:
+            state->subtitle_in_ms = Kit_max(value, 0);
+            break;
+        case KIT_HINT_IDLE_SUSPEND_MS:
+            state->idle_suspend_ms = Kit_max(value, 0);
+            break;
+        case KIT_HINT_VIDEO_SCALE_QUALITY:
+            state->scale_quality = Kit_max(Kit_min(value, KIT_SCALE_COUNT - 1), 0);
+            break;
+        case KIT_HINT_VIDEO_CONVERT_THREADS:
+            state->convert_threads = Kit_max(Kit_min(value, SDL_GetCPUCount()), 1);
+            break;
+        case KIT_HINT_VIDEO_LOWRES:
+            state->video_lowres = Kit_max(Kit_min(value, 3), 0);
+            break;
+        case KIT_HINT_VIDEO_RGBA_OUTPUT:
+            state->video_rgba_output = Kit_max(Kit_min(value, 1), 0);
+            break;
     }
 }
 
@@ -124,11 +189,56 @@ int Kit_GetHint(Kit_HintType type) {
             return state->audio_buf_frames;
         case KIT_HINT_SUBTITLE_BUFFER_FRAMES:
             return state->subtitle_buf_frames;
+        case KIT_HINT_WORKER_THREADS:
+            return state->worker_threads;
+        case KIT_HINT_MANUAL_PUMP:
+            return state->manual_pump;
+        case KIT_HINT_THREAD_PRIORITY:
+            return state->thread_priority;
+        case KIT_HINT_THREAD_AFFINITY:
+            return (int)state->thread_affinity;
+        case KIT_HINT_VIDEO_BUFFER_BYTES:
+            return state->video_buf_bytes;
+        case KIT_HINT_AUDIO_BUFFER_BYTES:
+            return state->audio_buf_bytes;
+        case KIT_HINT_VIDEO_BUFFER_MS:
+            return state->video_buf_ms;
+        case KIT_HINT_AUDIO_BUFFER_MS:
+            return state->audio_buf_ms;
+        case KIT_HINT_VIDEO_DIRECT_UPLOAD:
+            return state->video_direct_upload;
+        case KIT_HINT_VIDEO_INPUT_BYTES:
+            return state->video_in_bytes;
+        case KIT_HINT_AUDIO_INPUT_BYTES:
+            return state->audio_in_bytes;
+        case KIT_HINT_SUBTITLE_INPUT_BYTES:
+            return state->subtitle_in_bytes;
+        case KIT_HINT_VIDEO_INPUT_MS:
+            return state->video_in_ms;
+        case KIT_HINT_AUDIO_INPUT_MS:
+            return state->audio_in_ms;
+        case KIT_HINT_SUBTITLE_INPUT_MS:
+            return state->subtitle_in_ms;
+        case KIT_HINT_IDLE_SUSPEND_MS:
+            return state->idle_suspend_ms;
+        case KIT_HINT_VIDEO_SCALE_QUALITY:
+            return state->scale_quality;
+        case KIT_HINT_VIDEO_CONVERT_THREADS:
+            return state->convert_threads;
+        case KIT_HINT_VIDEO_LOWRES:
+            return state->video_lowres;
+        case KIT_HINT_VIDEO_RGBA_OUTPUT:
+            return state->video_rgba_output;
         default:
             return 0;
     }
 }
 
+void Kit_GetLibraryMemoryStats(Kit_MemoryStats *stats) {
+    assert(stats != NULL);
+    Kit_GetMemoryCounterStats(&Kit_GetLibraryState()->memory, stats);
+}
+
 void Kit_GetVersion(Kit_Version *version) {
     assert(version != NULL);
     version->major = KIT_VERSION_MAJOR;
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <float.h>
 
 #include <SDL.h>
 
@@ -9,6 +10,10 @@
 #include "kitchensink/internal/audio/kitaudio.h"
 #include "kitchensink/internal/subtitle/kitsubtitle.h"
 #include "kitchensink/internal/utils/kithelpers.h"
+#include "kitchensink/internal/utils/kitworker.h"
+#include "kitchensink/internal/utils/kitmpscqueue.h"
+#include "kitchensink/internal/utils/kitpacketpool.h"
+#include "kitchensink/internal/utils/kitmemory.h"
 
 enum DecoderIndex {
     KIT_VIDEO_DEC = 0,
@@ -17,10 +22,37 @@ enum DecoderIndex {
     KIT_DEC_COUNT
 };
 
+#define KIT_PREFILL_MAX_PACKETS 32
+#define KIT_COMMAND_QUEUE_SIZE 64
+#define KIT_AUDIO_PRIORITY_BIAS 0.1
+#define KIT_SUBTITLE_PRIORITY_BIAS 1.0
+
+enum {
+    KIT_CMD_START = 0, ///< Start playback from stopped state
+    KIT_CMD_PAUSE,     ///< Pause playback
+    KIT_CMD_RESUME,    ///< Resume playback from paused state
+    KIT_CMD_STOP,      ///< Stop playback and discard buffered data
+    KIT_CMD_SEEK,      ///< Seek to target
+    KIT_CMD_SUSPEND,   ///< Release codecs and buffers
+    KIT_CMD_RESTORE    ///< Reopen codecs released by suspend
+};
+
+typedef struct Kit_PlayerCommand {
+    int type;          ///< Command type (KIT_CMD_*)
+    double time;       ///< System time when the command was issued
+    double target;     ///< Seek target in seconds
+} Kit_PlayerCommand;
+
+static const char * const _WorkerNames[KIT_DEC_COUNT] = {
+    "Kit Video Decoder Thread",
+    "Kit Audio Decoder Thread",
+    "Kit Subtitle Decoder Thread",
+};
+
 // Return 0 if stream is good but nothing else to do for now
 // Return -1 if there may still work to be done
 // Return 1 if there was an error or stream end
-static int _DemuxStream(const Kit_Player *player) {
+static int _DemuxStream(Kit_Player *player) {
     assert(player != NULL);
     AVFormatContext *format_ctx = player->src->format_ctx;
     const Kit_Decoder *dec = NULL;
@@ -37,9 +69,13 @@ static int _DemuxStream(const Kit_Player *player) {
     }
 
     // Attempt to read frame. Just return here if it fails.
-    AVPacket *packet = av_packet_alloc();
+    AVPacket *packet = Kit_AcquirePacket(player->packet_pool);
+    if(packet == NULL) {
+        return 0;
+    }
     if(av_read_frame(format_ctx, packet) < 0) {
-        av_packet_free(&packet);
+        Kit_ReleasePacket(player->packet_pool, packet);
+        player->eof = true;
         return 1;
     }
 
@@ -49,100 +85,454 @@ static int _DemuxStream(const Kit_Player *player) {
         if(dec == NULL)
             continue;
         if(dec->stream_index == packet->stream_index) {
-            Kit_WriteDecoderInput(player->decoders[i], packet);
+            // Room was checked above, so this should not fail. If it does anyway, the packet is
+            // dropped rather than leaked.
+            if(Kit_WriteDecoderInput(player->decoders[i], packet) != 0) {
+                Kit_ReleasePacket(player->packet_pool, packet);
+            }
             return -1;
         }
     }
 
     // We only get here if packet was not written to a decoder. IF that is the case,
-    // disregard and free the packet.
-    av_packet_free(&packet);
+    // disregard and recycle the packet.
+    Kit_ReleasePacket(player->packet_pool, packet);
     return -1;
 }
 
+static bool _IsInputEmpty(const Kit_Player *player) {
+    const Kit_Decoder *dec = NULL;
+    for(int i = 0; i < KIT_DEC_COUNT; i++) {
+        dec = player->decoders[i];
+        if(dec == NULL)
+            continue;
+        if(!Kit_IsDecoderInputEmpty(dec))
+            return false;
+    }
+    return true;
+}
+
 static bool _IsOutputEmpty(const Kit_Player *player) {
     const Kit_Decoder *dec = NULL;
     for(int i = 0; i < KIT_DEC_COUNT; i++) {
         dec = player->decoders[i];
         if(dec == NULL)
             continue;
-        if(Kit_PeekDecoderOutput(dec))
+        if(!Kit_IsDecoderOutputEmpty(dec))
             return false;
     }
     return true;
 }
 
-static int _RunDecoder(const Kit_Player *player) {
+// Demuxes and decodes until the sync decoder (video, or audio if there is no video) has output,
+// so that playback can start with a correct clock. Rest is left for the workers. This is bounded
+// to keep control calls fast. Workers must be locked by the caller.
+static void _PrefillDecoders(Kit_Player *player) {
+    const Kit_Decoder *sync = player->decoders[KIT_VIDEO_DEC];
+    bool decoded;
     int got;
-    bool has_room = true;
-    const Kit_Decoder *dec = NULL;
 
-    do {
-        while((got = _DemuxStream(player)) == -1);
-        if(got == 1 && _IsOutputEmpty(player)) {
-            return 1;
+    if(sync == NULL) {
+        sync = player->decoders[KIT_AUDIO_DEC];
+    }
+    for(int i = 0; i < KIT_PREFILL_MAX_PACKETS; i++) {
+        if(sync == NULL || !Kit_IsDecoderOutputEmpty(sync)) {
+            break;
+        }
+        got = _DemuxStream(player);
+        decoded = false;
+        for(int k = 0; k < KIT_DEC_COUNT; k++) {
+            decoded |= (Kit_RunDecoder(player->decoders[k]) == 1);
         }
+        if(got != -1 && !decoded) {
+            break;
+        }
+    }
+}
 
-        for(int i = 0; i < KIT_DEC_COUNT; i++) {
-            while(Kit_RunDecoder(player->decoders[i]) == 1);
+static Kit_PlayerState _GetState(const Kit_Player *player) {
+    return SDL_AtomicGet((SDL_atomic_t*)&player->state);
+}
+
+static void _MarkIdle(Kit_Player *player) {
+    // Zero means not idle, so make sure the timestamp is never that.
+    Uint32 now = SDL_GetTicks();
+    SDL_AtomicSet(&player->idle_since, (int)(now > 0 ? now : 1));
+}
+
+static bool _HasPendingCommands(const Kit_Player *player) {
+    return SDL_AtomicGet((SDL_atomic_t*)&player->pending_commands) > 0;
+}
+
+static void _SetClockSync(const Kit_Player *player) {
+    double sync = _GetSystemTime();
+    for(int i = 0; i < KIT_DEC_COUNT; i++) {
+        Kit_SetDecoderClockSync(player->decoders[i], sync);
+    }
+}
+
+static void _ChangeClockSync(const Kit_Player *player, double delta) {
+    for(int i = 0; i < KIT_DEC_COUNT; i++) {
+        Kit_ChangeDecoderClockSync(player->decoders[i], delta);
+    }
+}
+
+static void _ClearBuffers(const Kit_Player *player) {
+    for(int i = 0; i < KIT_DEC_COUNT; i++) {
+        Kit_ClearDecoderBuffers(player->decoders[i]);
+    }
+}
+
+static int _SeekSource(Kit_Player *player, double seek_set) {
+    double position;
+    double duration;
+    int64_t seek_target;
+    int flags = AVSEEK_FLAG_ANY;
+    int err;
+
+    duration = Kit_GetPlayerDuration(player);
+    position = Kit_GetPlayerPosition(player);
+    if(seek_set <= 0) {
+        seek_set = 0;
+    }
+    if(seek_set >= duration) {
+        seek_set = duration;
+    }
+
+    // Set source to timestamp
+    AVFormatContext *format_ctx = player->src->format_ctx;
+    seek_target = seek_set * AV_TIME_BASE;
+    if(seek_set < position) {
+        flags |= AVSEEK_FLAG_BACKWARD;
+    }
+
+    // First, tell ffmpeg to seek stream. If not capable, stop here. Kit_PlayerSeek() has already
+    // ruled out unseekable sources, so this is an I/O error or similar. We are not on the caller's
+    // thread, so the error is stored for Kit_GetPlayerSeekError(); playback continues where it was.
+    err = avformat_seek_file(format_ctx, -1, seek_target, seek_target, INT64_MAX, flags);
+    if(err < 0) {
+        SDL_AtomicSet(&player->seek_error, err);
+        return 1;
+    }
+
+    // Clean old buffers and try to fill them with new data
+    player->eof = false;
+    _ClearBuffers(player);
+    _PrefillDecoders(player);
+
+    // Try to get a precise seek position from the next audio/video frame
+    // (depending on which one is used to sync). Output readers may be running, so hold the lock.
+    double precise_pts = -1.0F;
+    const Kit_Decoder *sync = player->decoders[KIT_VIDEO_DEC];
+    if(sync != NULL && Kit_LockDecoderOutput(sync) == 0) {
+        precise_pts = Kit_GetVideoDecoderPTS(sync);
+        Kit_UnlockDecoderOutput(sync);
+    } else if(sync == NULL) {
+        sync = player->decoders[KIT_AUDIO_DEC];
+        if(sync != NULL && Kit_LockDecoderOutput(sync) == 0) {
+            precise_pts = Kit_GetAudioDecoderPTS(sync);
+            Kit_UnlockDecoderOutput(sync);
         }
+    }
 
-        // If there is no room in any decoder input, just stop here since it likely means that
-        // at least some decoder output is full.
-        for(int i = 0; i < KIT_DEC_COUNT; i++) {
-            dec = player->decoders[i];
-            if(dec == NULL)
-                continue;
-            if(!Kit_CanWriteDecoderInput(dec) || got == 1) {
-                has_room = false;
-                break;
+    // If we got a legit looking value, set it as seek value. Otherwise use
+    // the seek value we requested.
+    if(precise_pts >= 0) {
+        _ChangeClockSync(player, position - precise_pts);
+    } else {
+        _ChangeClockSync(player, position - seek_set);
+    }
+    return 0;
+}
+
+static void _SuspendPlayer(Kit_Player *player) {
+    if(player->suspended)
+        return;
+    player->suspend_pos = Kit_GetPlayerPosition(player);
+    for(int i = 0; i < KIT_DEC_COUNT; i++) {
+        Kit_SuspendDecoder(player->decoders[i]);
+    }
+    player->suspended = true;
+}
+
+static int _RestorePlayer(Kit_Player *player) {
+    int64_t seek_target;
+    int err;
+    if(!player->suspended)
+        return 0;
+    for(int i = 0; i < KIT_DEC_COUNT; i++) {
+        if(Kit_ResumeDecoder(player->decoders[i]) != 0) {
+            // Keep the player consistently suspended, so that the next attempt starts over.
+            while(--i >= 0) {
+                Kit_SuspendDecoder(player->decoders[i]);
             }
+            return 1;
         }
-    } while(has_room);
+    }
 
+    // Go back to the last keyframe at or before where we left off. Clocks are not touched, so
+    // output before the suspend position is dropped by the normal sync logic.
+    AVFormatContext *format_ctx = player->src->format_ctx;
+    // If this fails, decoding just continues from wherever the source is. We are not on the
+    // caller's thread, so the error is stored for Kit_GetPlayerSeekError().
+    seek_target = player->suspend_pos * AV_TIME_BASE;
+    err = avformat_seek_file(format_ctx, -1, INT64_MIN, seek_target, seek_target, 0);
+    if(err < 0) {
+        SDL_AtomicSet(&player->seek_error, err);
+    }
+    player->eof = false;
+    player->suspended = false;
     return 0;
 }
 
-static void _TryWork(Kit_Player *player) {
-    /**
-     * \brief Run the decoders and demuxer as long as there is work. Returns when playback stops.
-     */
-    while(player->state == KIT_PLAYING || player->state == KIT_PAUSED) {
-        // Grab the decoder lock, and run demuxer & decoders for a bit.
-        if(SDL_LockMutex(player->dec_lock) == 0) {
-            if(_RunDecoder(player) == 1) {
-                player->state = KIT_STOPPED;
+static int _LockDecoderWorkers(const Kit_Player *player) {
+    for(int i = 0; i < KIT_DEC_COUNT; i++) {
+        if(player->decode_workers[i] == NULL)
+            continue;
+        if(Kit_LockWorker(player->decode_workers[i]) != 0) {
+            while(--i >= 0) {
+                if(player->decode_workers[i] != NULL)
+                    Kit_UnlockWorker(player->decode_workers[i]);
             }
-            SDL_UnlockMutex(player->dec_lock);
+            return 1;
         }
+    }
+    return 0;
+}
 
-        // Delay to make sure this thread does not hog all cpu
-        SDL_Delay(2);
+static void _UnlockDecoderWorkers(const Kit_Player *player) {
+    for(int i = KIT_DEC_COUNT - 1; i >= 0; i--) {
+        if(player->decode_workers[i] != NULL)
+            Kit_UnlockWorker(player->decode_workers[i]);
+    }
+}
+
+static void _RunCommand(Kit_Player *player, const Kit_PlayerCommand *cmd) {
+    // Player state has already been changed by the caller; this just does the heavy lifting.
+    // Demuxer worker lock is held by us, so just lock the decoders. If the codecs can not be
+    // reopened, the player stays suspended and nothing is demuxed or decoded.
+    if(_LockDecoderWorkers(player) != 0) {
+        return;
+    }
+    switch(cmd->type) {
+        case KIT_CMD_START:
+            if(_RestorePlayer(player) == 0) {
+                _PrefillDecoders(player); // Get first frames before starting playback
+            }
+            _SetClockSync(player);
+            break;
+        case KIT_CMD_PAUSE:
+            player->pause_started = cmd->time;
+            break;
+        case KIT_CMD_RESUME:
+            _RestorePlayer(player);
+            _ChangeClockSync(player, cmd->time - player->pause_started);
+            break;
+        case KIT_CMD_STOP:
+            _ClearBuffers(player);
+            break;
+        case KIT_CMD_SEEK:
+            if(_RestorePlayer(player) == 0) {
+                _SeekSource(player, cmd->target);
+            }
+            break;
+        case KIT_CMD_SUSPEND:
+            _SuspendPlayer(player);
+            break;
+        case KIT_CMD_RESTORE:
+            _RestorePlayer(player);
+            break;
     }
+    _UnlockDecoderWorkers(player);
 }
 
-static int _DecoderThread(void *ptr) {
+static int _DemuxStep(void *ptr) {
     /**
-     * \brief Decoder thread main, which runs as long as the player exists.
+     * \brief Demuxer worker step. Reads a single packet, so that the lock is not held for long.
      */
     Kit_Player *player = ptr;
+    Kit_PlayerCommand cmd;
+    Kit_PlayerState state;
+
+    // Handle control commands first. Output readers idle until the pending count drops to zero.
+    // Once the player is closing, commands are just dropped.
+    while(Kit_PopMPSCQueue(player->commands, &cmd) == 0) {
+        if(_GetState(player) != KIT_CLOSED) {
+            _RunCommand(player, &cmd);
+        }
+        SDL_AtomicAdd(&player->pending_commands, -1);
+    }
 
-    while(true) {
-        if(player->state == KIT_CLOSED) {
-            break;
+    state = _GetState(player);
+    if(state != KIT_PLAYING && state != KIT_PAUSED) {
+        return 0;
+    }
+    if(player->suspended) {
+        return 0;
+    }
+    if(_DemuxStream(player) == -1) {
+        return 1;
+    }
+
+    // Source has been read completely, and everything has been decoded and played. We're done.
+    if(player->eof && _IsInputEmpty(player) && _IsOutputEmpty(player)) {
+        if(SDL_AtomicCAS(&player->state, state, KIT_STOPPED)) {
+            _MarkIdle(player);
+        }
+    }
+    return 0;
+}
+
+static int _DecodeStep(void *ptr) {
+    /**
+     * \brief Decoder worker step. Decodes a single packet, so that the lock is not held for long.
+     */
+    Kit_Decoder *dec = ptr;
+
+    // Audio gaps are much more noticeable than dropped video frames. If the decoder we yield to
+    // is running low, let it catch up first; it wakes us up again after each packet. We only
+    // wait for a short while at a time, so that video never starves completely. Audio may stop
+    // waking us without ever catching up (full output, end of stream), so check back regardless.
+    if(Kit_ShouldDecoderYield(dec)) {
+        return KIT_WORKER_WAIT;
+    }
+    if(Kit_RunDecoder(dec) == 1) {
+        Kit_RaiseSignal(dec->yield_signal);
+        return 1;
+    }
+
+    // If this decoder has run dry, let the demuxer know. It either needs to read more
+    // packets, or check if playback has finished.
+    if(Kit_IsDecoderInputEmpty(dec) && Kit_IsDecoderOutputEmpty(dec)) {
+        Kit_RaiseSignal(dec->demux_signal);
+    }
+    return 0;
+}
+
+static double _GetDecoderUrgency(const Kit_Player *player, int index) {
+    // Smaller is more urgent. Audio is given a head start, and subtitles go last.
+    const Kit_Decoder *dec = player->decoders[index];
+    if(dec == NULL)
+        return DBL_MAX;
+    switch(index) {
+        case KIT_AUDIO_DEC: return Kit_GetDecoderHeadroom(dec) - KIT_AUDIO_PRIORITY_BIAS;
+        case KIT_SUBTITLE_DEC: return Kit_GetDecoderHeadroom(dec) + KIT_SUBTITLE_PRIORITY_BIAS;
+        default: return Kit_GetDecoderHeadroom(dec);
+    }
+}
+
+static void _GetDecoderOrder(const Kit_Player *player, int order[KIT_DEC_COUNT]) {
+    // Sorts decoder indexes by presentation time deadline, most urgent first.
+    double urgency[KIT_DEC_COUNT];
+    int tmp;
+    for(int i = 0; i < KIT_DEC_COUNT; i++) {
+        order[i] = i;
+        urgency[i] = _GetDecoderUrgency(player, i);
+    }
+    for(int i = 1; i < KIT_DEC_COUNT; i++) {
+        for(int k = i; k > 0 && urgency[order[k]] < urgency[order[k - 1]]; k--) {
+            tmp = order[k];
+            order[k] = order[k - 1];
+            order[k - 1] = tmp;
         }
-        
-        // This will block as long as there is something to demux/decode
-        // Returns when playback stops.
-        _TryWork(player);
+    }
+}
 
-        // Just idle while waiting for work.
-        SDL_Delay(25);
+static int _LockWorkers(const Kit_Player *player) {
+    if(Kit_LockWorker(player->demux_worker) != 0) {
+        return 1;
+    }
+    if(_LockDecoderWorkers(player) != 0) {
+        Kit_UnlockWorker(player->demux_worker);
+        return 1;
     }
+    return 0;
+}
+
+static void _UnlockWorkers(const Kit_Player *player) {
+    _UnlockDecoderWorkers(player);
+    Kit_UnlockWorker(player->demux_worker);
+}
 
+static int _PushCommand(Kit_Player *player, int type, double target) {
+    // Caller must have already bumped the pending command count.
+    Kit_PlayerCommand cmd;
+    cmd.type = type;
+    cmd.time = _GetSystemTime();
+    cmd.target = target;
+    if(Kit_PushMPSCQueue(player->commands, &cmd) != 0) {
+        Kit_SetError("Player command queue is full");
+        return 1;
+    }
+    Kit_WakeWorker(player->demux_worker);
     return 0;
 }
 
+static bool _Transition(Kit_Player *player, Kit_PlayerState from, Kit_PlayerState to, int type) {
+    // Command is marked pending before the state changes, so that output readers never see
+    // the new state with stale clocks or buffers. If anything fails, everything is rolled back.
+    SDL_AtomicAdd(&player->pending_commands, 1);
+    if(!SDL_AtomicCAS(&player->state, from, to)) {
+        SDL_AtomicAdd(&player->pending_commands, -1);
+        return false;
+    }
+    if(_PushCommand(player, type, 0) != 0) {
+        SDL_AtomicCAS(&player->state, to, from);
+        SDL_AtomicAdd(&player->pending_commands, -1);
+        return false;
+    }
+    return true;
+}
+
+static void _CheckIdleTimeout(Kit_Player *player) {
+    // Workers sleep while there is nothing to do, so the idle timeout is checked from the calls
+    // applications keep making every frame. Only one caller gets to suspend.
+    unsigned int timeout = Kit_GetLibraryState()->idle_suspend_ms;
+    int since = SDL_AtomicGet(&player->idle_since);
+    if(timeout == 0 || since == 0)
+        return;
+    if(SDL_GetTicks() - (Uint32)since < timeout)
+        return;
+    if(SDL_AtomicCAS(&player->idle_since, since, 0)) {
+        Kit_PlayerSuspend(player);
+    }
+}
+
+static Kit_Worker* _CreateWorker(Kit_WorkerPool *pool, const char *name, Kit_WorkerStep step, void *userdata) {
+    if(Kit_GetLibraryState()->manual_pump) {
+        return Kit_CreateManualWorker(step, userdata);
+    }
+    return Kit_CreateWorker(pool, name, step, userdata);
+}
+
+static void _CloseWorkers(Kit_Player *player) {
+    Kit_Decoder *dec = NULL;
+
+    // Demuxer runs control commands that lock and use the decoder workers, so it goes first.
+    // Decoders must not raise its signal after that (or each others), so disconnect them while
+    // nothing is running.
+    if(_LockWorkers(player) == 0) {
+        for(int i = 0; i < KIT_DEC_COUNT; i++) {
+            dec = player->decoders[i];
+            if(dec == NULL)
+                continue;
+            dec->demux_signal = NULL;
+            dec->yield_signal = NULL;
+        }
+        _UnlockWorkers(player);
+    }
+    Kit_CloseWorker(player->demux_worker);
+    player->demux_worker = NULL;
+    for(int i = KIT_DEC_COUNT - 1; i >= 0; i--) {
+        Kit_CloseWorker(player->decode_workers[i]);
+        player->decode_workers[i] = NULL;
+        dec = player->decoders[i];
+        if(dec != NULL) {
+            dec->decode_signal = NULL;
+        }
+    }
+}
+
 Kit_Player* Kit_CreatePlayer(const Kit_Source *src,
                              int video_stream_index,
                              int audio_stream_index,
@@ -164,50 +554,118 @@ Kit_Player* Kit_CreatePlayer(const Kit_Source *src,
         goto EXIT_0;
     }
 
+    // Memory usage of all decoders is tracked here.
+    player->memory = calloc(1, sizeof(Kit_MemoryCounter));
+    if(player->memory == NULL) {
+        Kit_SetError("Unable to allocate player");
+        goto EXIT_1;
+    }
+
     // Initialize audio decoder
-    player->decoders[KIT_AUDIO_DEC] = Kit_CreateAudioDecoder(src, audio_stream_index);
+    player->decoders[KIT_AUDIO_DEC] = Kit_CreateAudioDecoder(src, audio_stream_index, player->memory);
     if(player->decoders[KIT_AUDIO_DEC] == NULL && audio_stream_index >= 0) {
-        goto EXIT_1;
+        goto EXIT_2;
     }
 
     // Initialize video decoder
-    player->decoders[KIT_VIDEO_DEC] = Kit_CreateVideoDecoder(src, video_stream_index);
+    player->decoders[KIT_VIDEO_DEC] = Kit_CreateVideoDecoder(src, video_stream_index, player->memory);
     if(player->decoders[KIT_VIDEO_DEC] == NULL && video_stream_index >= 0) {
         goto EXIT_2;
     }
 
-    // Initialize subtitle decoder.
-    Kit_OutputFormat output;
-    Kit_GetDecoderOutputFormat(player->decoders[KIT_VIDEO_DEC], &output);
+    // Initialize subtitle decoder. Subtitles are positioned in stream coordinates, so they use the
+    // stream size even if video is decoded at a lower resolution.
+    int video_w = 0;
+    int video_h = 0;
+    if(player->decoders[KIT_VIDEO_DEC] != NULL) {
+        const AVFormatContext *format_ctx = src->format_ctx;
+        video_w = format_ctx->streams[video_stream_index]->codecpar->width;
+        video_h = format_ctx->streams[video_stream_index]->codecpar->height;
+    }
     player->decoders[KIT_SUBTITLE_DEC] = Kit_CreateSubtitleDecoder(
-        src, subtitle_stream_index, output.width, output.height, screen_w, screen_h);
+        src, subtitle_stream_index, video_w, video_h, screen_w, screen_h, player->memory);
     if(player->decoders[KIT_SUBTITLE_DEC] == NULL && subtitle_stream_index >= 0) {
         goto EXIT_2;
     }
 
-    // Decoder thread lock
-    player->dec_lock = SDL_CreateMutex();
-    if(player->dec_lock == NULL) {
-        Kit_SetError("Unable to create a decoder thread lock mutex: %s", SDL_GetError());
+    // Control commands are passed to the demuxer worker through a lock-free queue.
+    player->commands = Kit_CreateMPSCQueue(KIT_COMMAND_QUEUE_SIZE, sizeof(Kit_PlayerCommand));
+    if(player->commands == NULL) {
+        Kit_SetError("Unable to allocate player command queue");
         goto EXIT_2;
     }
 
-    // Decoder thread
-    player->dec_thread = SDL_CreateThread(_DecoderThread, "Kit Decoder Thread", player);
-    if(player->dec_thread == NULL) {
-        Kit_SetError("Unable to create a decoder thread: %s", SDL_GetError());
+    // Packets are recycled between the demuxer and decoders. Every input buffer slot may hold
+    // one, and the demuxer may be holding one more.
+    unsigned int pool_size = 1;
+    for(int i = 0; i < KIT_DEC_COUNT; i++) {
+        pool_size += Kit_GetDecoderInputSize(player->decoders[i]);
+    }
+    player->packet_pool = Kit_CreatePacketPool(pool_size);
+    if(player->packet_pool == NULL) {
+        Kit_SetError("Unable to allocate player packet pool");
         goto EXIT_3;
     }
+    for(int i = 0; i < KIT_DEC_COUNT; i++) {
+        if(player->decoders[i] != NULL) {
+            ((Kit_Decoder*)player->decoders[i])->packet_pool = player->packet_pool;
+        }
+    }
 
+    // Demuxer worker, and a separate worker for each decoder so that a slow video decode does
+    // not hold up audio. These all idle until playback is started.
+    // If the shared worker pool is enabled, decoder workers are run by it instead of their own
+    // threads. Demuxer always gets its own thread, since av_read_frame() may block on I/O for a
+    // long time, and would stall every other player's decoding if it ran on a pool thread.
+    // In manual pump mode, nothing runs them until the caller asks with Kit_PlayerPump().
     player->src = src;
+    const Kit_LibraryState *state = Kit_GetLibraryState();
+    Kit_WorkerPool *pool = NULL;
+    if(!state->manual_pump && state->worker_threads > 0) {
+        pool = Kit_GetLibraryWorkerPool();
+        if(pool == NULL) {
+            goto EXIT_4;
+        }
+    }
+    player->demux_worker = _CreateWorker(NULL, "Kit Demuxer Thread", _DemuxStep, player);
+    if(player->demux_worker == NULL) {
+        goto EXIT_4;
+    }
+    Kit_Decoder *dec = NULL;
+    for(int i = 0; i < KIT_DEC_COUNT; i++) {
+        dec = player->decoders[i];
+        if(dec == NULL)
+            continue;
+        dec->demux_signal = ((Kit_Worker*)player->demux_worker)->signal;
+        player->decode_workers[i] = _CreateWorker(pool, _WorkerNames[i], _DecodeStep, dec);
+        if(player->decode_workers[i] == NULL) {
+            goto EXIT_5;
+        }
+        dec->decode_signal = ((Kit_Worker*)player->decode_workers[i])->signal;
+    }
+
+    // Video decoding gives way to audio when audio is about to run dry.
+    Kit_Decoder *audio_dec = player->decoders[KIT_AUDIO_DEC];
+    Kit_Decoder *video_dec = player->decoders[KIT_VIDEO_DEC];
+    if(audio_dec != NULL && video_dec != NULL) {
+        video_dec->yield_to = audio_dec;
+        audio_dec->yield_signal = video_dec->decode_signal;
+    }
+
+    _MarkIdle(player);
     return player;
 
+EXIT_5:
+    _CloseWorkers(player);
+EXIT_4:
+    Kit_DestroyPacketPool(player->packet_pool);
 EXIT_3:
-    SDL_DestroyMutex(player->dec_lock);
+    Kit_DestroyMPSCQueue(player->commands);
 EXIT_2:
     for(int i = 0; i < KIT_DEC_COUNT; i++) {
         Kit_CloseDecoder(player->decoders[i]);
     }
+    free(player->memory);
 EXIT_1:
     free(player);
 EXIT_0:
@@ -217,18 +675,20 @@ EXIT_0:
 void Kit_ClosePlayer(Kit_Player *player) {
     if(player == NULL) return;
 
-    // Kill the decoder thread and mutex
-    if(SDL_LockMutex(player->dec_lock) == 0) {
-        player->state = KIT_CLOSED;
-        SDL_UnlockMutex(player->dec_lock);
+    // Kill the demuxer and decoder workers
+    if(_LockWorkers(player) == 0) {
+        SDL_AtomicSet(&player->state, KIT_CLOSED);
+        _UnlockWorkers(player);
     }
-    SDL_WaitThread(player->dec_thread, NULL);
-    SDL_DestroyMutex(player->dec_lock);
+    _CloseWorkers(player);
+    Kit_DestroyMPSCQueue(player->commands);
+    Kit_DestroyPacketPool(player->packet_pool);
 
     // Shutdown decoders
     for(int i = 0; i < KIT_DEC_COUNT; i++) {
         Kit_CloseDecoder(player->decoders[i]);
     }
+    free(player->memory);
 
     // Free the player structure itself
     free(player);
@@ -242,6 +702,16 @@ void Kit_SetPlayerScreenSize(Kit_Player *player, int w, int h) {
     Kit_SetSubtitleDecoderSize(dec, w, h);
 }
 
+void Kit_SetPlayerOutputSize(Kit_Player *player, int w, int h) {
+    assert(player != NULL);
+    assert(w >= 0);
+    assert(h >= 0);
+    Kit_Decoder *dec = player->decoders[KIT_VIDEO_DEC];
+    if(dec == NULL)
+        return;
+    Kit_SetVideoDecoderSize(dec, w, h);
+}
+
 int Kit_GetPlayerVideoStream(const Kit_Player *player) {
     assert(player != NULL);
     return Kit_GetDecoderStreamIndex(player->decoders[KIT_VIDEO_DEC]);
@@ -265,15 +735,49 @@ int Kit_GetPlayerVideoDataArea(Kit_Player *player, SDL_Texture *texture, SDL_Rec
         return 0;
     }
 
-    // If paused or stopped, do nothing
-    if(player->state == KIT_PAUSED) {
+    // If paused or stopped, do nothing. Same if a control command is still being handled.
+    Kit_PlayerState state = _GetState(player);
+    if(state != KIT_PLAYING || _HasPendingCommands(player)) {
+        _CheckIdleTimeout(player);
+        return 0;
+    }
+
+    // Output may be cleared by a control command at any time; the lock keeps our frame alive.
+    int ret = 0;
+    if(Kit_LockDecoderOutput(dec) == 0) {
+        ret = Kit_GetVideoDecoderData(dec, texture, area);
+        Kit_UnlockDecoderOutput(dec);
+    }
+    return ret;
+}
+
+int Kit_AcquirePlayerVideoFrame(Kit_Player *player, Kit_VideoFrame *frame) {
+    assert(player != NULL);
+    assert(frame != NULL);
+
+    Kit_Decoder *dec = player->decoders[KIT_VIDEO_DEC];
+    if(dec == NULL) {
         return 0;
     }
-    if(player->state == KIT_STOPPED) {
+
+    // If paused or stopped, do nothing. Same if a control command is still being handled.
+    Kit_PlayerState state = _GetState(player);
+    if(state != KIT_PLAYING || _HasPendingCommands(player)) {
+        _CheckIdleTimeout(player);
         return 0;
     }
 
-    return Kit_GetVideoDecoderData(dec, texture, area);
+    int ret = 0;
+    if(Kit_LockDecoderOutput(dec) == 0) {
+        ret = Kit_AcquireVideoDecoderFrame(dec, frame);
+        Kit_UnlockDecoderOutput(dec);
+    }
+    return ret;
+}
+
+void Kit_ReleasePlayerVideoFrame(Kit_VideoFrame *frame) {
+    if(frame == NULL) return;
+    Kit_ReleaseVideoDecoderFrame(frame);
 }
 
 int Kit_GetPlayerVideoData(Kit_Player *player, SDL_Texture *texture) {
@@ -296,15 +800,19 @@ int Kit_GetPlayerAudioData(Kit_Player *player, unsigned char *buffer, int length
         return 0;
     }
 
-    // If paused or stopped, do nothing
-    if(player->state == KIT_PAUSED) {
-        return 0;
-    }
-    if(player->state == KIT_STOPPED) {
+    // If paused or stopped, do nothing. Same if a control command is still being handled.
+    Kit_PlayerState state = _GetState(player);
+    if(state != KIT_PLAYING || _HasPendingCommands(player)) {
+        _CheckIdleTimeout(player);
         return 0;
     }
 
-    return Kit_GetAudioDecoderData(dec, buffer, length);
+    int ret = 0;
+    if(Kit_LockDecoderOutput(dec) == 0) {
+        ret = Kit_GetAudioDecoderData(dec, buffer, length);
+        Kit_UnlockDecoderOutput(dec);
+    }
+    return ret;
 }
 
 int Kit_GetPlayerSubtitleData(Kit_Player *player, SDL_Texture *texture, SDL_Rect *sources, SDL_Rect *targets, int limit) {
@@ -320,18 +828,22 @@ int Kit_GetPlayerSubtitleData(Kit_Player *player, SDL_Texture *texture, SDL_Rect
         return 0;
     }
 
-    // If paused, just return the current items
-    if(player->state == KIT_PAUSED) {
+    // If paused, or a control command is still being handled, just return the current items
+    Kit_PlayerState state = _GetState(player);
+    if(state == KIT_PAUSED || (state == KIT_PLAYING && _HasPendingCommands(player))) {
         return Kit_GetSubtitleDecoderInfo(sub_dec, texture, sources, targets, limit);
     }
 
     // If stopped, do nothing.
-    if(player->state == KIT_STOPPED) {
+    if(state != KIT_PLAYING) {
         return 0;
     }
 
     // Refresh texture, then refresh rects and return number of items in the texture.
-    Kit_GetSubtitleDecoderTexture(sub_dec, texture, video_dec->clock_pos);
+    if(Kit_LockDecoderOutput(sub_dec) == 0) {
+        Kit_GetSubtitleDecoderTexture(sub_dec, texture, video_dec->clock_pos);
+        Kit_UnlockDecoderOutput(sub_dec);
+    }
     return Kit_GetSubtitleDecoderInfo(sub_dec, texture, sources, targets, limit);
 }
 
@@ -348,133 +860,144 @@ void Kit_GetPlayerInfo(const Kit_Player *player, Kit_PlayerInfo *info) {
     }
 }
 
-static void _SetClockSync(const Kit_Player *player) {
-    double sync = _GetSystemTime();
-    for(int i = 0; i < KIT_DEC_COUNT; i++) {
-        Kit_SetDecoderClockSync(player->decoders[i], sync);
+Kit_PlayerState Kit_GetPlayerState(const Kit_Player *player) {
+    assert(player != NULL);
+    return _GetState(player);
+}
+
+void Kit_PlayerPlay(Kit_Player *player) {
+    assert(player != NULL);
+    if(_Transition(player, KIT_STOPPED, KIT_PLAYING, KIT_CMD_START)
+            || _Transition(player, KIT_PAUSED, KIT_PLAYING, KIT_CMD_RESUME)) {
+        SDL_AtomicSet(&player->idle_since, 0);
     }
 }
 
-static void _ChangeClockSync(const Kit_Player *player, double delta) {
-    for(int i = 0; i < KIT_DEC_COUNT; i++) {
-        Kit_ChangeDecoderClockSync(player->decoders[i], delta);
+void Kit_PlayerStop(Kit_Player *player) {
+    assert(player != NULL);
+    if(_Transition(player, KIT_PLAYING, KIT_STOPPED, KIT_CMD_STOP)
+            || _Transition(player, KIT_PAUSED, KIT_STOPPED, KIT_CMD_STOP)) {
+        _MarkIdle(player);
     }
 }
 
-Kit_PlayerState Kit_GetPlayerState(const Kit_Player *player) {
+void Kit_PlayerPause(Kit_Player *player) {
     assert(player != NULL);
-    return player->state;
+    if(_Transition(player, KIT_PLAYING, KIT_PAUSED, KIT_CMD_PAUSE)) {
+        _MarkIdle(player);
+    }
 }
 
-void Kit_PlayerPlay(Kit_Player *player) {
+int Kit_PlayerSeek(Kit_Player *player, double seek_set) {
     assert(player != NULL);
-    double tmp;
-    if(SDL_LockMutex(player->dec_lock) == 0) {
-        switch(player->state) {
-            case KIT_PLAYING:
-            case KIT_CLOSED:
-                break;
-            case KIT_PAUSED:
-                tmp = _GetSystemTime() - player->pause_started;
-                _ChangeClockSync(player, tmp);
-                player->state = KIT_PLAYING;
-                break;
-            case KIT_STOPPED:
-                _RunDecoder(player); // Fill some buffers before starting playback
-                _SetClockSync(player);
-                player->state = KIT_PLAYING;
-                break;
-        }
-        SDL_UnlockMutex(player->dec_lock);
+
+    // Seek itself is done on the demuxer worker, and its errors are only seen later via
+    // Kit_GetPlayerSeekError(). Catch what we can here. Custom sources without a seek callback
+    // and most live streams end up here.
+    const AVFormatContext *format_ctx = player->src->format_ctx;
+    const AVIOContext *pb = format_ctx->pb;
+    if(seek_set != seek_set) {
+        Kit_SetError("Invalid seek target");
+        return 1;
     }
+    if(pb != NULL && !(pb->seekable & AVIO_SEEKABLE_NORMAL)) {
+        Kit_SetError("Source is not seekable");
+        return 1;
+    }
+
+    SDL_AtomicAdd(&player->pending_commands, 1);
+    if(_PushCommand(player, KIT_CMD_SEEK, seek_set) != 0) {
+        SDL_AtomicAdd(&player->pending_commands, -1);
+        return 1;
+    }
+    return 0;
 }
 
-void Kit_PlayerStop(Kit_Player *player) {
+int Kit_GetPlayerSeekError(Kit_Player *player) {
     assert(player != NULL);
-    if(SDL_LockMutex(player->dec_lock) == 0) {
-        switch(player->state) {
-            case KIT_STOPPED:
-            case KIT_CLOSED:
-                break;
-            case KIT_PLAYING:
-            case KIT_PAUSED:
-                player->state = KIT_STOPPED;
-                for(int i = 0; i < KIT_DEC_COUNT; i++) {
-                    Kit_ClearDecoderBuffers(player->decoders[i]);
-                }
-                break;
-        }
-        SDL_UnlockMutex(player->dec_lock);
+    int err = SDL_AtomicSet(&player->seek_error, 0);
+    if(err != 0) {
+        Kit_SetError("Unable to seek source (error %d)", err);
+        return 1;
     }
+    return 0;
 }
 
-void Kit_PlayerPause(Kit_Player *player) {
+int Kit_PlayerSuspend(Kit_Player *player) {
     assert(player != NULL);
-    player->state = KIT_PAUSED;
-    player->pause_started = _GetSystemTime();
+
+    // Nothing can be played while suspended, so make sure the clocks stop, too.
+    Kit_PlayerPause(player);
+    SDL_AtomicSet(&player->idle_since, 0);
+    SDL_AtomicAdd(&player->pending_commands, 1);
+    if(_PushCommand(player, KIT_CMD_SUSPEND, 0) != 0) {
+        SDL_AtomicAdd(&player->pending_commands, -1);
+        return 1;
+    }
+    return 0;
 }
 
-int Kit_PlayerSeek(Kit_Player *player, double seek_set) {
+int Kit_PlayerResume(Kit_Player *player) {
     assert(player != NULL);
-    double position;
-    double duration;
-    int64_t seek_target;
-    int flags = AVSEEK_FLAG_ANY;
 
-    if(SDL_LockMutex(player->dec_lock) == 0) {
-        duration = Kit_GetPlayerDuration(player);
-        position = Kit_GetPlayerPosition(player);
-        if(seek_set <= 0) {
-            seek_set = 0;
-        }
-        if(seek_set >= duration) {
-            seek_set = duration;
-        }
+    // If the player stays idle after this, the idle timeout starts over.
+    if(_GetState(player) != KIT_PLAYING) {
+        _MarkIdle(player);
+    }
+    SDL_AtomicAdd(&player->pending_commands, 1);
+    if(_PushCommand(player, KIT_CMD_RESTORE, 0) != 0) {
+        SDL_AtomicAdd(&player->pending_commands, -1);
+        return 1;
+    }
+    return 0;
+}
 
-        // Set source to timestamp
-        AVFormatContext *format_ctx = player->src->format_ctx;
-        seek_target = seek_set * AV_TIME_BASE;
-        if(seek_set < position) {
-            flags |= AVSEEK_FLAG_BACKWARD;
-        }
+int Kit_PlayerPump(Kit_Player *player, int budget_us) {
+    assert(player != NULL);
+    const Uint64 start = SDL_GetPerformanceCounter();
+    const Uint64 budget = (Uint64)(budget_us > 0 ? budget_us : 0) * SDL_GetPerformanceFrequency() / 1000000;
+    bool ran;
 
-        // First, tell ffmpeg to seek stream. If not capable, stop here.
-        // Failure here probably means that stream is unseekable someway, eg. streamed media
-        if(avformat_seek_file(format_ctx, -1, seek_target, seek_target, INT64_MAX, flags) < 0) {
-            Kit_SetError("Unable to seek source");
-            SDL_UnlockMutex(player->dec_lock);
-            return 1;
-        }
+    int order[KIT_DEC_COUNT];
 
-        // Clean old buffers and try to fill them with new data
+    if(_GetState(player) != KIT_PLAYING) {
+        _CheckIdleTimeout(player);
+    }
+
+    // Run demuxer and decoder steps in turns until nobody has anything to do, or we run out of time.
+    // Decoders closest to running dry go first. Workers that are not in manual mode are ignored
+    // by Kit_RunWorker().
+    do {
+        ran = Kit_RunWorker(player->demux_worker);
+        _GetDecoderOrder(player, order);
         for(int i = 0; i < KIT_DEC_COUNT; i++) {
-            Kit_ClearDecoderBuffers(player->decoders[i]);
+            ran |= Kit_RunWorker(player->decode_workers[order[i]]);
         }
-        _RunDecoder(player);
+    } while(ran && SDL_GetPerformanceCounter() - start < budget);
 
-        // Try to get a precise seek position from the next audio/video frame
-        // (depending on which one is used to sync)
-        double precise_pts = -1.0F;
-        if(player->decoders[KIT_VIDEO_DEC] != NULL) {
-            precise_pts = Kit_GetVideoDecoderPTS(player->decoders[KIT_VIDEO_DEC]);
-        }
-        else if(player->decoders[KIT_AUDIO_DEC] != NULL) {
-            precise_pts = Kit_GetAudioDecoderPTS(player->decoders[KIT_AUDIO_DEC]);
-        }
+    return ran ? 1 : 0;
+}
 
-        // If we got a legit looking value, set it as seek value. Otherwise use
-        // the seek value we requested.
-        if(precise_pts >= 0) {
-            _ChangeClockSync(player, position - precise_pts);
-        } else {
-            _ChangeClockSync(player, position - seek_set);
-        }
+void Kit_GetPlayerMemoryStats(const Kit_Player *player, Kit_MemoryStats *stats) {
+    assert(player != NULL);
+    assert(stats != NULL);
+    Kit_GetMemoryCounterStats(player->memory, stats);
+}
 
-        // That's it. Unlock and continue.
-        SDL_UnlockMutex(player->dec_lock);
+void Kit_GetPlayerStats(const Kit_Player *player, Kit_PlayerStats *stats) {
+    assert(player != NULL);
+    assert(stats != NULL);
+    int max_hold = Kit_GetWorkerMaxHoldTime(player->demux_worker);
+    for(int i = 0; i < KIT_DEC_COUNT; i++) {
+        int hold = Kit_GetWorkerMaxHoldTime(player->decode_workers[i]);
+        if(hold > max_hold) {
+            max_hold = hold;
+        }
     }
-
-    return 0;
+    memset(stats, 0, sizeof(Kit_PlayerStats));
+    stats->max_lock_hold = max_hold / 1000000.0;
+    stats->packet_allocations = Kit_GetPacketPoolAllocations(player->packet_pool);
+    stats->convert_time = Kit_GetVideoDecoderConvertTime(player->decoders[KIT_VIDEO_DEC]);
 }
 
 double Kit_GetPlayerDuration(const Kit_Player *player) {
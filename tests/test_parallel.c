@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <SDL_cpuinfo.h>
+#include <SDL_thread.h>
+#include <SDL_timer.h>
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+
+#include "kitchensink/internal/utils/kitparallel.h"
+#include "kitchensink/internal/video/kityuv.h"
+
+/*
+ * Measures sliced frame conversion throughput against the number of slices, the same way the
+ * video decoder splits frames (see KIT_HINT_VIDEO_CONVERT_THREADS): slice heights are aligned
+ * to 16 rows, and each slice has its own swscale context.
+ *
+ * Sliced output must be identical to converting the frame in one go, also when several threads
+ * share one runner and their batches end up running inline. Timings are printed, not checked.
+ */
+
+#define KIT_TEST_WIDTH 1920
+#define KIT_TEST_HEIGHT 1080
+#define KIT_TEST_SLICE_ALIGN 16
+#define KIT_TEST_MAX_SLICES 16
+#define KIT_TEST_ROUNDS 30
+#define KIT_TEST_SHARED_CALLERS 3
+
+typedef struct Kit_TestSlices {
+    const AVFrame *src;
+    AVFrame *dst;
+    const Kit_YUVConverter *yuv;          ///< Converter, or NULL to use swscale
+    struct SwsContext *sws[KIT_TEST_MAX_SLICES];
+    int slice_h;
+} Kit_TestSlices;
+
+typedef struct Kit_TestCaller {
+    Kit_Parallel *parallel;
+    const AVFrame *src;
+    const AVFrame *expected;
+    const Kit_YUVConverter *yuv;
+    int slice_count;
+    bool ok;
+} Kit_TestCaller;
+
+static AVFrame* _CreateFrame(enum AVPixelFormat fmt) {
+    AVFrame *frame = av_frame_alloc();
+    if(frame == NULL)
+        return NULL;
+    frame->format = fmt;
+    frame->width = KIT_TEST_WIDTH;
+    frame->height = KIT_TEST_HEIGHT;
+    frame->colorspace = AVCOL_SPC_BT709;
+    frame->color_range = AVCOL_RANGE_MPEG;
+    if(av_frame_get_buffer(frame, 32) < 0) {
+        av_frame_free(&frame);
+        return NULL;
+    }
+    return frame;
+}
+
+static void _FillSource(AVFrame *frame) {
+    unsigned int seed = 1;
+    for(int p = 0; p < 3; p++) {
+        int h = p == 0 ? frame->height : (frame->height + 1) / 2;
+        for(int y = 0; y < h; y++) {
+            for(int x = 0; x < frame->linesize[p]; x++) {
+                seed = seed * 1103515245 + 12345;
+                frame->data[p][y * frame->linesize[p] + x] = (unsigned char)(16 + ((seed >> 16) % 220));
+            }
+        }
+    }
+}
+
+static void _ConvertSlice(void *userdata, int index) {
+    Kit_TestSlices *slices = userdata;
+    const AVFrame *src = slices->src;
+    AVFrame *dst = slices->dst;
+    const uint8_t *src_data[4] = {NULL, NULL, NULL, NULL};
+    uint8_t *dst_data[4] = {NULL, NULL, NULL, NULL};
+    int y = index * slices->slice_h;
+    int h = src->height - y < slices->slice_h ? src->height - y : slices->slice_h;
+    if(h <= 0)
+        return;
+    if(slices->yuv != NULL) {
+        Kit_RunYUVConverter(slices->yuv, src, dst->data[0], dst->linesize[0], y, h);
+        return;
+    }
+    for(int p = 0; p < 3; p++) {
+        src_data[p] = src->data[p] + (p == 0 ? y : y / 2) * src->linesize[p];
+    }
+    dst_data[0] = dst->data[0] + y * dst->linesize[0];
+    slices->sws[index] = sws_getCachedContext(
+        slices->sws[index], src->width, h, src->format, dst->width, h, dst->format,
+        SWS_BILINEAR, NULL, NULL, NULL);
+    if(slices->sws[index] == NULL)
+        return;
+    sws_scale(slices->sws[index], src_data, src->linesize, 0, h, dst_data, dst->linesize);
+}
+
+static void _RunSliced(Kit_Parallel *parallel, Kit_TestSlices *slices, int slice_count) {
+    slices->slice_h = (slices->src->height + slice_count - 1) / slice_count;
+    slices->slice_h = (slices->slice_h + KIT_TEST_SLICE_ALIGN - 1) & ~(KIT_TEST_SLICE_ALIGN - 1);
+    if(parallel == NULL) {
+        for(int i = 0; i < slice_count; i++) {
+            _ConvertSlice(slices, i);
+        }
+        return;
+    }
+    Kit_RunParallel(parallel, _ConvertSlice, slices, slice_count);
+}
+
+static bool _SameImage(const AVFrame *a, const AVFrame *b) {
+    for(int y = 0; y < a->height; y++) {
+        if(memcmp(a->data[0] + y * a->linesize[0], b->data[0] + y * b->linesize[0], a->width * 4) != 0)
+            return false;
+    }
+    return true;
+}
+
+static void _FreeSlices(Kit_TestSlices *slices) {
+    for(int i = 0; i < KIT_TEST_MAX_SLICES; i++) {
+        sws_freeContext(slices->sws[i]);
+        slices->sws[i] = NULL;
+    }
+}
+
+static int _SharedCaller(void *ptr) {
+    // Several decoders share the library runner; whoever finds it busy converts by itself.
+    Kit_TestCaller *caller = ptr;
+    Kit_TestSlices slices;
+    memset(&slices, 0, sizeof(Kit_TestSlices));
+    slices.src = caller->src;
+    slices.yuv = caller->yuv;
+    slices.dst = _CreateFrame(AV_PIX_FMT_RGBA);
+    caller->ok = slices.dst != NULL;
+    for(int i = 0; i < KIT_TEST_ROUNDS && caller->ok; i++) {
+        memset(slices.dst->data[0], 0, slices.dst->linesize[0] * slices.dst->height);
+        _RunSliced(caller->parallel, &slices, caller->slice_count);
+        caller->ok = _SameImage(slices.dst, caller->expected);
+    }
+    av_frame_free(&slices.dst);
+    return 0;
+}
+
+static double _Measure(Kit_Parallel *parallel, Kit_TestSlices *slices, int slice_count) {
+    Uint64 start;
+    _RunSliced(parallel, slices, slice_count);  // Warm up contexts and caches
+    start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < KIT_TEST_ROUNDS; i++) {
+        _RunSliced(parallel, slices, slice_count);
+    }
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000.0
+        / SDL_GetPerformanceFrequency() / KIT_TEST_ROUNDS;
+}
+
+int main(int argc, char *argv[]) {
+    int max_slices = SDL_GetCPUCount() < KIT_TEST_MAX_SLICES ? SDL_GetCPUCount() : KIT_TEST_MAX_SLICES;
+    AVFrame *src = _CreateFrame(AV_PIX_FMT_YUV420P);
+    AVFrame *expected = _CreateFrame(AV_PIX_FMT_RGBA);
+    AVFrame *dst = _CreateFrame(AV_PIX_FMT_RGBA);
+    Kit_Parallel *parallel = NULL;
+    Kit_YUVConverter yuv;
+    Kit_TestSlices slices;
+    Kit_TestCaller callers[KIT_TEST_SHARED_CALLERS];
+    SDL_Thread *threads[KIT_TEST_SHARED_CALLERS];
+    double yuv_base = 0;
+    double sws_base = 0;
+    double yuv_ms;
+    double sws_ms;
+    bool shared_ok = true;
+    int failed = 0;
+
+    if(src == NULL || expected == NULL || dst == NULL || !Kit_InitYUVConverter(&yuv, src, AV_PIX_FMT_RGBA)) {
+        printf("unable to set up test\n");
+        return 1;
+    }
+    _FillSource(src);
+    memset(&slices, 0, sizeof(Kit_TestSlices));
+    slices.src = src;
+    slices.yuv = &yuv;
+    slices.dst = expected;
+    _RunSliced(NULL, &slices, 1);
+
+    printf("%dx%d yuv420p -> rgba, ms per frame (speedup)\n", KIT_TEST_WIDTH, KIT_TEST_HEIGHT);
+    for(int count = 1; count <= max_slices; count++) {
+        parallel = count > 1 ? Kit_CreateParallel(count - 1) : NULL;
+        if(count > 1 && parallel == NULL) {
+            printf("%2d slices: unable to create runner\n", count);
+            failed++;
+            break;
+        }
+
+        slices.dst = dst;
+        slices.yuv = &yuv;
+        memset(dst->data[0], 0, dst->linesize[0] * dst->height);
+        yuv_ms = _Measure(parallel, &slices, count);
+        if(!_SameImage(dst, expected)) {
+            printf("%2d slices: sliced output differs\n", count);
+            failed++;
+        }
+        slices.yuv = NULL;
+        sws_ms = _Measure(parallel, &slices, count);
+        _FreeSlices(&slices);
+
+        if(count == 1) {
+            yuv_base = yuv_ms;
+            sws_base = sws_ms;
+        }
+        printf("%2d slices: converter %7.3f (%.2fx), swscale %7.3f (%.2fx)\n",
+               count, yuv_ms, yuv_base / yuv_ms, sws_ms, sws_base / sws_ms);
+
+        // Largest runner is also used for the shared runner check.
+        if(count < max_slices) {
+            Kit_CloseParallel(parallel);
+            parallel = NULL;
+        }
+    }
+
+    if(parallel != NULL) {
+        for(int i = 0; i < KIT_TEST_SHARED_CALLERS; i++) {
+            callers[i].parallel = parallel;
+            callers[i].src = src;
+            callers[i].expected = expected;
+            callers[i].yuv = &yuv;
+            callers[i].slice_count = max_slices;
+            callers[i].ok = false;
+            threads[i] = SDL_CreateThread(_SharedCaller, "Kit Test Caller", &callers[i]);
+        }
+        for(int i = 0; i < KIT_TEST_SHARED_CALLERS; i++) {
+            SDL_WaitThread(threads[i], NULL);
+            if(threads[i] == NULL || !callers[i].ok) {
+                shared_ok = false;
+            }
+        }
+        printf("shared runner, %d callers: %s\n", KIT_TEST_SHARED_CALLERS, shared_ok ? "ok" : "FAIL");
+        if(!shared_ok) {
+            failed++;
+        }
+        Kit_CloseParallel(parallel);
+    }
+
+    av_frame_free(&dst);
+    av_frame_free(&expected);
+    av_frame_free(&src);
+    return failed > 0 ? 1 : 0;
+}
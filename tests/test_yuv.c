@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <SDL_timer.h>
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+
+#include "kitchensink/internal/video/kityuv.h"
+
+/*
+ * Checks the 4:2:0 to RGBA/BGRA converter, and times it against swscale.
+ *
+ * 1. All row kernels usable on this CPU (AVX2, SSE2, NEON) must give exactly the same output as
+ *    the plain C one, for all row widths up to a few chunks.
+ * 2. The converter must be within KIT_TEST_EXACT_DIFF of the exact (floating point) BT.601 or
+ *    BT.709 conversion; the only error comes from the Q12 coefficients.
+ * 3. swscale works from 8-bit lookup tables (or 16-bit SIMD) and rounds differently, so each
+ *    channel may differ from it by at most KIT_TEST_SWS_MAX_DIFF, and on average by at most
+ *    KIT_TEST_SWS_MEAN_DIFF. Chroma planes are smooth ramps, so that the result does not depend
+ *    on whether swscale repeats or interpolates chroma samples (it interpolates vertically for
+ *    odd heights and NV12).
+ */
+
+#define KIT_TEST_EXACT_DIFF 1
+#define KIT_TEST_SWS_MAX_DIFF 4
+#define KIT_TEST_SWS_MEAN_DIFF 1.0
+#define KIT_TEST_KERNEL_WIDTH 1100
+#define KIT_TEST_TIMING_ROUNDS 50
+
+typedef struct Kit_TestCase {
+    const char *name;
+    enum AVPixelFormat src_fmt;
+    enum AVPixelFormat dst_fmt;
+    int width;
+    int height;
+    bool bt709;
+} Kit_TestCase;
+
+typedef struct Kit_TestDiff {
+    int max;
+    double mean;
+} Kit_TestDiff;
+
+static const Kit_TestCase test_cases[] = {
+    {"yuv420p bt601 -> rgba", AV_PIX_FMT_YUV420P, AV_PIX_FMT_RGBA, 640, 360, false},
+    {"yuv420p bt709 -> rgba", AV_PIX_FMT_YUV420P, AV_PIX_FMT_RGBA, 1920, 1080, true},
+    {"yuv420p bt601 -> bgra", AV_PIX_FMT_YUV420P, AV_PIX_FMT_BGRA, 640, 360, false},
+    {"yuvj420p bt601 -> rgba", AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_RGBA, 640, 360, false},
+    {"nv12 bt601 -> rgba", AV_PIX_FMT_NV12, AV_PIX_FMT_RGBA, 640, 360, false},
+    {"yuv420p odd size -> rgba", AV_PIX_FMT_YUV420P, AV_PIX_FMT_RGBA, 333, 199, false},
+};
+
+static unsigned int _Random(unsigned int *state) {
+    *state = *state * 1103515245 + 12345;
+    return (*state >> 16) & 0x7FFF;
+}
+
+static double _Elapsed(Uint64 start) {
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static bool _TestKernels(void) {
+    // Coefficients come from real converter setups, so that all four matrices and BGRA are covered.
+    static const struct {
+        enum AVPixelFormat src_fmt;
+        enum AVColorSpace colorspace;
+        enum AVPixelFormat dst_fmt;
+    } setups[] = {
+        {AV_PIX_FMT_YUV420P, AVCOL_SPC_BT470BG, AV_PIX_FMT_RGBA},
+        {AV_PIX_FMT_YUV420P, AVCOL_SPC_BT709, AV_PIX_FMT_BGRA},
+        {AV_PIX_FMT_YUVJ420P, AVCOL_SPC_BT470BG, AV_PIX_FMT_RGBA},
+        {AV_PIX_FMT_YUVJ420P, AVCOL_SPC_BT709, AV_PIX_FMT_RGBA},
+    };
+    unsigned char y[KIT_TEST_KERNEL_WIDTH];
+    unsigned char u[KIT_TEST_KERNEL_WIDTH / 2 + 1];
+    unsigned char v[KIT_TEST_KERNEL_WIDTH / 2 + 1];
+    unsigned char expected[KIT_TEST_KERNEL_WIDTH * 4];
+    unsigned char result[KIT_TEST_KERNEL_WIDTH * 4];
+    unsigned int seed = 1;
+    Kit_YUVConverter conv;
+    Kit_YUVRowFunc ref = NULL;
+    Kit_YUVRowFunc row = NULL;
+    const char *name = NULL;
+    AVFrame frame;
+    bool ok = true;
+    int count = 0;
+
+    while(Kit_GetYUVRowFunc(count, &name) != NULL) {
+        ref = Kit_GetYUVRowFunc(count++, &name);
+    }
+    if(strcmp(name, "c") != 0) {
+        printf("kernels: plain C kernel missing\n");
+        return false;
+    }
+
+    memset(&frame, 0, sizeof(AVFrame));
+    for(int k = 0; k < count - 1; k++) {
+        row = Kit_GetYUVRowFunc(k, &name);
+        bool same = true;
+        for(size_t s = 0; s < sizeof(setups) / sizeof(setups[0]) && same; s++) {
+            frame.format = setups[s].src_fmt;
+            frame.colorspace = setups[s].colorspace;
+            Kit_InitYUVConverter(&conv, &frame, setups[s].dst_fmt);
+            for(int width = 1; width <= KIT_TEST_KERNEL_WIDTH && same; width++) {
+                for(int i = 0; i < width; i++) {
+                    y[i] = (unsigned char)_Random(&seed);
+                    u[i / 2] = (unsigned char)_Random(&seed);
+                    v[i / 2] = (unsigned char)_Random(&seed);
+                }
+                memset(result, 0, sizeof(result));
+                ref(y, u, v, expected, width, &conv.coeffs);
+                row(y, u, v, result, width, &conv.coeffs);
+                if(memcmp(expected, result, width * 4) != 0) {
+                    printf("kernels: %s differs from c at width %d\n", name, width);
+                    same = false;
+                }
+            }
+        }
+        printf("kernels: %-4s %s\n", name, same ? "matches c exactly" : "FAIL");
+        ok = ok && same;
+    }
+    return ok;
+}
+
+static AVFrame* _CreateSource(const Kit_TestCase *test) {
+    bool full_range = test->src_fmt == AV_PIX_FMT_YUVJ420P;
+    int lo = full_range ? 0 : 16;
+    int y_span = full_range ? 256 : 220;
+    int c_span = full_range ? 256 : 225;
+    int cw = (test->width + 1) / 2;
+    int ch = (test->height + 1) / 2;
+    unsigned int seed = 1;
+    unsigned char *row;
+
+    AVFrame *frame = av_frame_alloc();
+    if(frame == NULL)
+        return NULL;
+    frame->format = test->src_fmt;
+    frame->width = test->width;
+    frame->height = test->height;
+    frame->colorspace = test->bt709 ? AVCOL_SPC_BT709 : AVCOL_SPC_BT470BG;
+    frame->color_range = full_range ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+    if(av_frame_get_buffer(frame, 32) < 0) {
+        av_frame_free(&frame);
+        return NULL;
+    }
+
+    // Noisy luma, and chroma ramps running in opposite directions.
+    for(int y = 0; y < test->height; y++) {
+        row = frame->data[0] + y * frame->linesize[0];
+        for(int x = 0; x < test->width; x++) {
+            row[x] = (unsigned char)(lo + _Random(&seed) % y_span);
+        }
+    }
+    for(int y = 0; y < ch; y++) {
+        for(int x = 0; x < cw; x++) {
+            unsigned char u = (unsigned char)(lo + x * (c_span - 1) / cw);
+            unsigned char v = (unsigned char)(lo + (c_span - 1) - y * (c_span - 1) / ch);
+            if(test->src_fmt == AV_PIX_FMT_NV12) {
+                frame->data[1][y * frame->linesize[1] + x * 2] = u;
+                frame->data[1][y * frame->linesize[1] + x * 2 + 1] = v;
+            } else {
+                frame->data[1][y * frame->linesize[1] + x] = u;
+                frame->data[2][y * frame->linesize[2] + x] = v;
+            }
+        }
+    }
+    return frame;
+}
+
+static AVFrame* _CreateTarget(const Kit_TestCase *test) {
+    AVFrame *frame = av_frame_alloc();
+    if(frame == NULL)
+        return NULL;
+    frame->format = test->dst_fmt;
+    frame->width = test->width;
+    frame->height = test->height;
+    if(av_frame_get_buffer(frame, 32) < 0) {
+        av_frame_free(&frame);
+        return NULL;
+    }
+    return frame;
+}
+
+static unsigned char _Round(double value) {
+    return value < 0.0 ? 0 : (value > 255.0 ? 255 : (unsigned char)(value + 0.5));
+}
+
+static void _ConvertExact(const Kit_TestCase *test, const AVFrame *src, AVFrame *dst) {
+    // Straight from the matrix definition, with chroma samples repeated like the converter does.
+    bool full_range = test->src_fmt == AV_PIX_FMT_YUVJ420P;
+    bool bgra = test->dst_fmt == AV_PIX_FMT_BGRA;
+    double kr = test->bt709 ? 0.2126 : 0.299;
+    double kb = test->bt709 ? 0.0722 : 0.114;
+    double kg = 1.0 - kr - kb;
+    double y_mul = full_range ? 1.0 : 255.0 / 219.0;
+    double c_mul = full_range ? 1.0 : 255.0 / 224.0;
+    double yy, uu, vv;
+    int cu, cv;
+    unsigned char *out;
+
+    for(int y = 0; y < test->height; y++) {
+        for(int x = 0; x < test->width; x++) {
+            if(test->src_fmt == AV_PIX_FMT_NV12) {
+                cu = src->data[1][(y / 2) * src->linesize[1] + (x / 2) * 2];
+                cv = src->data[1][(y / 2) * src->linesize[1] + (x / 2) * 2 + 1];
+            } else {
+                cu = src->data[1][(y / 2) * src->linesize[1] + x / 2];
+                cv = src->data[2][(y / 2) * src->linesize[2] + x / 2];
+            }
+            yy = (src->data[0][y * src->linesize[0] + x] - (full_range ? 0 : 16)) * y_mul;
+            uu = (cu - 128) * c_mul;
+            vv = (cv - 128) * c_mul;
+            out = dst->data[0] + y * dst->linesize[0] + x * 4;
+            out[bgra ? 2 : 0] = _Round(yy + 2.0 * (1.0 - kr) * vv);
+            out[1] = _Round(yy - 2.0 * kb * (1.0 - kb) / kg * uu - 2.0 * kr * (1.0 - kr) / kg * vv);
+            out[bgra ? 0 : 2] = _Round(yy + 2.0 * (1.0 - kb) * uu);
+            out[3] = 255;
+        }
+    }
+}
+
+static Kit_TestDiff _Compare(const Kit_TestCase *test, const AVFrame *a, const AVFrame *b) {
+    // Alpha is always opaque in all outputs, so only color channels are compared.
+    Kit_TestDiff result = {0, 0.0};
+    unsigned long long total = 0;
+    const unsigned char *row_a;
+    const unsigned char *row_b;
+    int diff;
+    for(int y = 0; y < test->height; y++) {
+        row_a = a->data[0] + y * a->linesize[0];
+        row_b = b->data[0] + y * b->linesize[0];
+        for(int x = 0; x < test->width * 4; x++) {
+            if((x & 3) == 3)
+                continue;
+            diff = abs(row_a[x] - row_b[x]);
+            total += diff;
+            if(diff > result.max) {
+                result.max = diff;
+            }
+        }
+    }
+    result.mean = (double)total / ((double)test->width * test->height * 3);
+    return result;
+}
+
+static struct SwsContext* _CreateReference(const Kit_TestCase *test) {
+    int *inv_table;
+    int *table;
+    int src_range;
+    int dst_range;
+    int brightness;
+    int contrast;
+    int saturation;
+
+    struct SwsContext *sws = sws_getContext(
+        test->width, test->height, test->src_fmt,
+        test->width, test->height, test->dst_fmt,
+        SWS_BILINEAR, NULL, NULL, NULL);
+    if(sws == NULL || !test->bt709)
+        return sws;
+
+    // swscale does not look at frame tags; the matrix has to be set up explicitly.
+    sws_getColorspaceDetails(sws, &inv_table, &src_range, &table, &dst_range, &brightness, &contrast, &saturation);
+    sws_setColorspaceDetails(
+        sws, sws_getCoefficients(SWS_CS_ITU709), src_range, table, dst_range, brightness, contrast, saturation);
+    return sws;
+}
+
+static bool _RunTest(const Kit_TestCase *test) {
+    Kit_YUVConverter conv;
+    AVFrame *src = _CreateSource(test);
+    AVFrame *dst = _CreateTarget(test);
+    AVFrame *ref = _CreateTarget(test);
+    struct SwsContext *sws = _CreateReference(test);
+    Kit_TestDiff exact;
+    Kit_TestDiff scaled;
+    double kit_ms;
+    double sws_ms;
+    Uint64 start;
+    bool ok = false;
+
+    if(src == NULL || dst == NULL || ref == NULL || sws == NULL) {
+        printf("%s: unable to set up test\n", test->name);
+        goto EXIT;
+    }
+    if(!Kit_InitYUVConverter(&conv, src, test->dst_fmt)) {
+        printf("%s: converter does not support the format\n", test->name);
+        goto EXIT;
+    }
+
+    start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < KIT_TEST_TIMING_ROUNDS; i++) {
+        Kit_RunYUVConverter(&conv, src, dst->data[0], dst->linesize[0], 0, src->height);
+    }
+    kit_ms = _Elapsed(start) / KIT_TEST_TIMING_ROUNDS;
+    _ConvertExact(test, src, ref);
+    exact = _Compare(test, dst, ref);
+
+    start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < KIT_TEST_TIMING_ROUNDS; i++) {
+        sws_scale(sws, (const unsigned char * const *)src->data, src->linesize, 0, src->height,
+                  ref->data, ref->linesize);
+    }
+    sws_ms = _Elapsed(start) / KIT_TEST_TIMING_ROUNDS;
+    scaled = _Compare(test, dst, ref);
+
+    ok = exact.max <= KIT_TEST_EXACT_DIFF
+        && scaled.max <= KIT_TEST_SWS_MAX_DIFF
+        && scaled.mean <= KIT_TEST_SWS_MEAN_DIFF;
+    printf("%-26s %s  exact max %d mean %.3f, swscale max %d mean %.3f, kit %.3f ms, swscale %.3f ms\n",
+           test->name, ok ? "ok  " : "FAIL", exact.max, exact.mean, scaled.max, scaled.mean, kit_ms, sws_ms);
+
+EXIT:
+    sws_freeContext(sws);
+    av_frame_free(&ref);
+    av_frame_free(&dst);
+    av_frame_free(&src);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    if(!_TestKernels()) {
+        failed++;
+    }
+    for(size_t i = 0; i < sizeof(test_cases) / sizeof(test_cases[0]); i++) {
+        if(!_RunTest(&test_cases[i])) {
+            failed++;
+        }
+    }
+    return failed > 0 ? 1 : 0;
+}